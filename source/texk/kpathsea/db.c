@@ -64,6 +64,326 @@ static string db_names[] = {
 #endif
 
 
+/* Binary indexes of ls-R.  Parsing a large ls-R costs tens of
+   milliseconds and several megabytes in every process, so after reading
+   one we write DB_NAME.idx next to it, if we can, and later runs map
+   that read-only and look names up in place.  The index records the
+   size and modification time of its ls-R and the directory it was made
+   for; if any of them differs, the index is ignored and rewritten, so
+   the text file stays the reference.  Indexes are only written when
+   TEXMFDBS_INDEX_WRITE is set, so that programs don't drop files into
+   the trees unasked; setting TEXMFDBS_INDEX to 0 stops them from being
+   read as well.
+
+   The layout is a header, an open addressing table of key numbers, the
+   keys (distinct file names), the directory references of each key in
+   ls-R order, and the strings.  Everything is in native byte order and
+   string offsets are relative to the string area.  */
+
+#if !defined (WIN32)
+#define DB_INDEX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef DB_INDEX
+
+#define DB_INDEX_SUFFIX ".idx"
+#define DB_INDEX_MAGIC "KPSEIDX1"
+#define DB_INDEX_ORDER 0x01020304
+
+typedef struct {
+  char magic[8];
+  unsigned order;
+  unsigned size;                /* of the whole file */
+  unsigned slot_count;          /* a power of two */
+  unsigned key_count;
+  unsigned ref_count;
+  unsigned string_size;
+  unsigned slots, keys, refs, strings; /* file offsets of the areas */
+  unsigned top_dir;             /* the directory of the ls-R */
+  long long lsr_size;
+  long long lsr_mtime;
+} db_index_header;
+
+typedef struct {
+  unsigned hash;
+  unsigned name;
+  unsigned first;               /* index of the first directory reference */
+  unsigned count;
+} db_index_key;
+
+struct kpse_db_index {
+  const char *base;
+  const db_index_header *header;
+};
+
+/* An ls-R entry collected for writing an index.  */
+typedef struct {
+  string name;
+  unsigned dir;
+  unsigned seq;
+} db_index_entry;
+
+typedef struct {
+  db_index_entry *entries;
+  unsigned count, size;
+  char *strings;
+  unsigned string_size, string_alloc;
+} db_index_data;
+
+/* The same keys have to hash the same way as in hash.c, that is, after
+   TRANSFORM.  */
+
+static unsigned
+db_index_hash (const_string key)
+{
+  unsigned h = 2166136261U;
+
+  while (*key)
+    h = (h ^ (unsigned) TRANSFORM ((unsigned char) *key++)) * 16777619U;
+  return h;
+}
+
+/* Return the boolean value of the variable NAME, or DFLT if unset.  */
+
+static boolean
+db_index_flag (kpathsea kpse, const_string name, boolean dflt)
+{
+  string value = kpathsea_var_value (kpse, name);
+  boolean wanted = value ? (*value != '0' && *value != 'f' && *value != 'n')
+                         : dflt;
+
+  free (value);
+  return wanted;
+}
+
+/* Map the index of DB_FILENAME, if there is a valid and fresh one.  */
+
+static boolean
+db_index_open (kpathsea kpse, const_string db_filename,
+               const_string top_dir)
+{
+  string idx_filename = concat (db_filename, DB_INDEX_SUFFIX);
+  const db_index_header *h;
+  struct stat lsr, idx;
+  const char *base;
+  int fd;
+
+  fd = open (idx_filename, O_RDONLY);
+  free (idx_filename);
+  if (fd < 0)
+    return false;
+  if (stat (db_filename, &lsr) != 0 || fstat (fd, &idx) != 0
+      || idx.st_size < (off_t) sizeof (db_index_header)) {
+    close (fd);
+    return false;
+  }
+  base = mmap (NULL, idx.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED)
+    return false;
+  h = (const db_index_header *) base;
+  if (memcmp (h->magic, DB_INDEX_MAGIC, 8) != 0
+      || h->order != DB_INDEX_ORDER
+      || h->size != (unsigned) idx.st_size
+      || h->lsr_size != (long long) lsr.st_size
+      || h->lsr_mtime != (long long) lsr.st_mtime
+      || h->slot_count == 0 || (h->slot_count & (h->slot_count - 1)) != 0
+      || h->slots + (size_t) h->slot_count * sizeof (unsigned) > h->size
+      || h->keys + (size_t) h->key_count * sizeof (db_index_key) > h->size
+      || h->refs + (size_t) h->ref_count * sizeof (unsigned) > h->size
+      || h->string_size == 0
+      || h->strings + (size_t) h->string_size > h->size
+      || base[h->strings + h->string_size - 1] != 0
+      || h->top_dir >= h->string_size
+      || !STREQ (base + h->strings + h->top_dir, top_dir)) {
+    munmap ((void *) base, idx.st_size);
+    return false;
+  }
+  kpse->db_indexes = (struct kpse_db_index *)
+    xrealloc (kpse->db_indexes,
+              (kpse->db_index_count + 1) * sizeof (struct kpse_db_index));
+  kpse->db_indexes[kpse->db_index_count].base = base;
+  kpse->db_indexes[kpse->db_index_count].header = h;
+  kpse->db_index_count++;
+  return true;
+}
+
+/* Append the directories of KEY in INDEX to RET.  */
+
+static void
+db_index_lookup (struct kpse_db_index *index, const_string key,
+                 cstr_list_type *ret)
+{
+  const db_index_header *h = index->header;
+  const unsigned *slots = (const unsigned *) (index->base + h->slots);
+  const db_index_key *keys = (const db_index_key *) (index->base + h->keys);
+  const unsigned *refs = (const unsigned *) (index->base + h->refs);
+  const char *strings = index->base + h->strings;
+  unsigned hash = db_index_hash (key);
+  unsigned mask = h->slot_count - 1;
+  unsigned i, n, probes;
+
+  for (n = hash & mask, probes = 0; slots[n] != 0 && probes < h->slot_count;
+       n = (n + 1) & mask, probes++) {
+    const db_index_key *k;
+    if (slots[n] > h->key_count)
+      return;
+    k = keys + slots[n] - 1;
+    if (k->hash == hash && k->name < h->string_size
+        && FILESTRCASEEQ (key, strings + k->name)) {
+      if (k->first + k->count > h->ref_count)
+        return;
+      for (i = 0; i < k->count; i++)
+        if (refs[k->first + i] < h->string_size)
+          cstr_list_add (ret, strings + refs[k->first + i]);
+      return;
+    }
+  }
+}
+
+static unsigned
+db_index_string (db_index_data *data, const_string s)
+{
+  unsigned offset = data->string_size;
+  unsigned len = strlen (s) + 1;
+
+  if (data->string_size + len > data->string_alloc) {
+    data->string_alloc = 2 * data->string_alloc + len;
+    data->strings = (char *) xrealloc (data->strings, data->string_alloc);
+  }
+  memcpy (data->strings + offset, s, len);
+  data->string_size += len;
+  return offset;
+}
+
+static void
+db_index_add (db_index_data *data, string name, unsigned dir)
+{
+  if (data->count == data->size) {
+    data->size = data->size ? 2 * data->size : 4096;
+    data->entries = (db_index_entry *)
+      xrealloc (data->entries, data->size * sizeof (db_index_entry));
+  }
+  data->entries[data->count].name = name;
+  data->entries[data->count].dir = dir;
+  data->entries[data->count].seq = data->count;
+  data->count++;
+}
+
+static int
+db_index_compare (const void *a, const void *b)
+{
+  const db_index_entry *x = (const db_index_entry *) a;
+  const db_index_entry *y = (const db_index_entry *) b;
+  int c = strcmp (x->name, y->name);
+
+  if (c != 0)
+    return c;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* Write the index for DB_FILENAME from DATA, quietly giving up when that
+   is not possible (as with a read-only tree).  The file is written
+   under a temporary name and renamed, so readers never see half an
+   index.  */
+
+static void
+db_index_write (const_string db_filename, db_index_data *data)
+{
+  db_index_header h;
+  db_index_key *keys;
+  unsigned *slots, *refs;
+  unsigned i, key_count = 0;
+  string idx_filename, tmp_filename;
+  char pid[32];
+  struct stat lsr;
+  FILE *f;
+  boolean ok;
+
+  if (stat (db_filename, &lsr) != 0)
+    return;
+  qsort (data->entries, data->count, sizeof (db_index_entry),
+         db_index_compare);
+  keys = XTALLOC (data->count, db_index_key);
+  refs = XTALLOC (data->count, unsigned);
+  for (i = 0; i < data->count; i++) {
+    if (i == 0 || !STREQ (data->entries[i].name, data->entries[i - 1].name)) {
+      keys[key_count].hash = db_index_hash (data->entries[i].name);
+      keys[key_count].name = db_index_string (data, data->entries[i].name);
+      keys[key_count].first = i;
+      keys[key_count].count = 0;
+      key_count++;
+    }
+    keys[key_count - 1].count++;
+    refs[i] = data->entries[i].dir;
+  }
+  memset (&h, 0, sizeof (h));
+  memcpy (h.magic, DB_INDEX_MAGIC, 8);
+  h.order = DB_INDEX_ORDER;
+  /* Keep the load factor at or below one half.  */
+  for (h.slot_count = 16; h.slot_count < 2 * key_count; h.slot_count *= 2)
+    ;
+  slots = XTALLOC (h.slot_count, unsigned);
+  memset (slots, 0, h.slot_count * sizeof (unsigned));
+  for (i = 0; i < key_count; i++) {
+    unsigned n = keys[i].hash & (h.slot_count - 1);
+    while (slots[n] != 0)
+      n = (n + 1) & (h.slot_count - 1);
+    slots[n] = i + 1;
+  }
+  h.key_count = key_count;
+  h.ref_count = data->count;
+  h.string_size = data->string_size;
+  h.slots = sizeof (h);
+  h.keys = h.slots + h.slot_count * sizeof (unsigned);
+  h.refs = h.keys + key_count * sizeof (db_index_key);
+  h.strings = h.refs + data->count * sizeof (unsigned);
+  h.size = h.strings + data->string_size;
+  h.top_dir = 0; /* The first string, see db_build.  */
+  h.lsr_size = lsr.st_size;
+  h.lsr_mtime = lsr.st_mtime;
+
+  idx_filename = concat (db_filename, DB_INDEX_SUFFIX);
+  sprintf (pid, ".%ld", (long) getpid ());
+  tmp_filename = concat (idx_filename, pid);
+  f = fopen (tmp_filename, FOPEN_WBIN_MODE);
+  if (f) {
+    ok = fwrite (&h, sizeof (h), 1, f) == 1
+      && fwrite (slots, sizeof (unsigned), h.slot_count, f) == h.slot_count
+      && fwrite (keys, sizeof (db_index_key), key_count, f) == key_count
+      && fwrite (refs, sizeof (unsigned), data->count, f) == data->count
+      && fwrite (data->strings, 1, data->string_size, f) == data->string_size;
+    if (fclose (f) != 0 || !ok || rename (tmp_filename, idx_filename) != 0)
+      unlink (tmp_filename);
+  }
+  free (tmp_filename);
+  free (idx_filename);
+  free (slots);
+  free (refs);
+  free (keys);
+}
+
+#endif /* DB_INDEX */
+
+/* Unmap the ls-R indexes of KPSE.  */
+
+void
+kpathsea_db_finish (kpathsea kpse)
+{
+#ifdef DB_INDEX
+  unsigned i;
+
+  for (i = 0; i < kpse->db_index_count; i++)
+    munmap ((void *) kpse->db_indexes[i].base,
+            kpse->db_indexes[i].header->size);
+#endif
+  free (kpse->db_indexes);
+  kpse->db_indexes = NULL;
+  kpse->db_index_count = 0;
+}
+
 /* If DIRNAME contains any element beginning with a `.' (that is more
    than just `./'), return true.  This is to allow ``hidden''
    directories -- ones that don't get searched.  */
@@ -93,14 +413,38 @@ db_build (kpathsea kpse, hash_table_type *table,  const_string db_filename)
   unsigned len = strlen (db_filename) - sizeof (DB_NAME) + 1; /* Keep the /. */
   string top_dir = (string)xmalloc (len + 1);
   string cur_dir = NULL; /* First thing in ls-R might be a filename.  */
-  FILE *db_file = fopen (db_filename, FOPEN_R_MODE);
+  FILE *db_file;
 #if defined(MONOCASE_FILENAMES)
   string pp;
 #endif /* MONOCASE_FILENAMES */
+#ifdef DB_INDEX
+  boolean reading = db_index_flag (kpse, "TEXMFDBS_INDEX", true);
+  boolean indexing = reading
+                     && db_index_flag (kpse, "TEXMFDBS_INDEX_WRITE", false);
+  db_index_data index_data;
+  unsigned dir_offset = 0;
+#endif /* DB_INDEX */
 
   strncpy (top_dir, db_filename, len);
   top_dir[len] = 0;
 
+#ifdef DB_INDEX
+  /* A fresh index spares us reading the text file at all.  */
+  if (reading && db_index_open (kpse, db_filename, top_dir)) {
+#ifdef KPSE_DEBUG
+    if (KPATHSEA_DEBUG_P (KPSE_DEBUG_HASH))
+      DEBUGF1 ("%s: using the binary index.\n", db_filename);
+#endif /* KPSE_DEBUG */
+    str_list_add (&(kpse->db_dir_list), top_dir);
+    return true;
+  }
+  memset (&index_data, 0, sizeof (index_data));
+  if (indexing)
+    db_index_string (&index_data, top_dir); /* The header's top_dir.  */
+#endif /* DB_INDEX */
+
+  db_file = fopen (db_filename, FOPEN_R_MODE);
+
   if (db_file) {
     while ((line = read_line (db_file)) != NULL) {
       len = strlen (line);
@@ -131,6 +475,10 @@ db_build (kpathsea kpse, hash_table_type *table,  const_string db_filename)
              won't work there, either, so it doesn't matter.  */
           cur_dir = *line == '.' ? concat (top_dir, line + 2) : xstrdup (line);
           dir_count++;
+#ifdef DB_INDEX
+          if (indexing)
+            dir_offset = db_index_string (&index_data, cur_dir);
+#endif /* DB_INDEX */
         } else {
           cur_dir = NULL;
           ignore_dir_count++;
@@ -149,8 +497,13 @@ db_build (kpathsea kpse, hash_table_type *table,  const_string db_filename)
            Note that we assume that all names in the ls-R file have already
            been case-smashed to lowercase where appropriate.
         */
-        hash_insert_normalized (table, xstrdup (line), cur_dir);
+        string key = xstrdup (line);
+        hash_insert_normalized (table, key, cur_dir);
         file_count++;
+#ifdef DB_INDEX
+        if (indexing)
+          db_index_add (&index_data, key, dir_offset);
+#endif /* DB_INDEX */
 
       } /* else ignore blank lines or top-level files
            or files in ignored directories*/
@@ -166,6 +519,10 @@ db_build (kpathsea kpse, hash_table_type *table,  const_string db_filename)
       db_file = NULL;
     } else {
       str_list_add (&(kpse->db_dir_list), xstrdup (top_dir));
+#ifdef DB_INDEX
+      if (indexing)
+        db_index_write (db_filename, &index_data);
+#endif /* DB_INDEX */
     }
 
 #ifdef KPSE_DEBUG
@@ -185,6 +542,10 @@ db_build (kpathsea kpse, hash_table_type *table,  const_string db_filename)
 #endif /* KPSE_DEBUG */
   }
 
+#ifdef DB_INDEX
+  free (index_data.entries);
+  free (index_data.strings);
+#endif /* DB_INDEX */
   free (top_dir);
 
   return db_file != NULL;
@@ -498,6 +859,35 @@ kpathsea_init_db (kpathsea kpse)
   free (orig_db_files);
 }
 
+/* Look up KEY in the hash table and the mapped indexes.  The results
+   from the indexes come first; the hash table holds the ls-R files
+   without an index and the files inserted at run time.  */
+
+static const_string *
+db_lookup (kpathsea kpse, const_string key)
+{
+  const_string *found = hash_lookup (kpse->db, key);
+#ifdef DB_INDEX
+  if (kpse->db_index_count > 0) {
+    cstr_list_type ret = cstr_list_init ();
+    const_string *r;
+    unsigned i;
+
+    for (i = 0; i < kpse->db_index_count; i++)
+      db_index_lookup (&kpse->db_indexes[i], key, &ret);
+    if (STR_LIST (ret)) {
+      for (r = found; r && *r; r++)
+        cstr_list_add (&ret, *r);
+      cstr_list_add (&ret, NULL);
+      if (found)
+        free ((void *) found);
+      found = STR_LIST (ret);
+    }
+  }
+#endif /* DB_INDEX */
+  return found;
+}
+
 /* Avoid doing anything if this PATH_ELT is irrelevant to the databases. */
 str_list_type *
 kpathsea_db_search (kpathsea kpse, const_string name,
@@ -577,7 +967,7 @@ kpathsea_db_search (kpathsea kpse, const_string name,
     const_string ctry = *r;
 
     /* We have an ls-R db.  Look up `try'.  */
-    orig_dirs = db_dirs = hash_lookup (kpse->db, ctry);
+    orig_dirs = db_dirs = db_lookup (kpse, ctry);
 
     ret = XTALLOC1 (str_list_type);
     *ret = str_list_init ();
@@ -738,7 +1128,7 @@ kpathsea_db_search_list (kpathsea kpse, string* names,
           const_string ctry = *r;
 
           /* We have an ls-R db.  Look up `try'.  */
-          orig_dirs = db_dirs = hash_lookup (kpse->db, ctry);
+          orig_dirs = db_dirs = db_lookup (kpse, ctry);
 
           /* For each filename found, see if it matches the path element.  For
              example, if we have .../cx/cmr10.300pk and .../ricoh/cmr10.300pk,
@@ -48,6 +48,9 @@ extern str_list_type *kpathsea_db_search_list (kpathsea kpse,
    Called by mktex() in tex-make.c.  */
 extern void kpathsea_db_insert (kpathsea kpse, const_string fname);
 
+/* Release the mapped ls-R indexes.  Called by kpathsea_finish.  */
+extern void kpathsea_db_finish (kpathsea kpse);
+
 #endif /* MAKE_KPSE_DLL */
 
 #endif /* not KPATHSEA_DB_H */
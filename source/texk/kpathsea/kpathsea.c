@@ -23,6 +23,7 @@
  */
 
 #include <kpathsea/config.h>
+#include <kpathsea/db.h>
 
 kpathsea
 kpathsea_new (void)
@@ -71,6 +72,7 @@ kpathsea_finish (kpathsea kpse)
 #endif /* KPATHSEA_CAN_FREE */
     if (kpse==NULL)
         return;
+    kpathsea_db_finish (kpse);
 #if KPATHSEA_CAN_FREE
     /* free internal stuff */
     hash_free (kpse->cnf_hash);
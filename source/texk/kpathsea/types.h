@@ -302,6 +302,10 @@ typedef struct kpathsea_instance {
     char st_buff[5];
     char *st_str;
 #endif
+    /* from db.c; kept last so that the offsets of the fields above do
+       not change for existing clients.  */
+    struct kpse_db_index *db_indexes;   /* mapped binary ls-R indexes */
+    unsigned db_index_count;
 } kpathsea_instance;
 
 /* these come from kpathsea.c */
@@ -147,6 +147,8 @@ fd_entry *lookup_fd_entry(char *);
 fd_entry *new_fd_entry(internal_font_number);
 void write_fontstuff(PDF);
 void register_fd_entry(fd_entry * fd);
+void set_font_cache_path(const char *);
+const char *get_font_cache_path(void);
 
 /* writet1.c */
 
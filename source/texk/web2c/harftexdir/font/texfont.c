@@ -144,6 +144,8 @@ int new_font(void)
     }
     /*tex character info zero is reserved for |notdef|. The stack size 1, default item value 0. */
     font_tables[id]->characters = new_sa_tree(1, 1, sa_value);
+    /*tex Font data is not rolled back by checkpoints. */
+    font_tables[id]->characters->journaled = 0;
     ci = xcalloc(1, sizeof(charinfo));
     set_charinfo_name(ci, xstrdup(".notdef"));
     font_tables[id]->charinfo = ci;
@@ -745,6 +747,8 @@ static void undump_math_kerns(charinfo * ci)
 {
     int k, x;
     undump_int(x);
+    if (!native_undump_size(x, 2 * sizeof(scaled)))
+        x = 0;
     ci->top_left_math_kerns = x;
     if (x > 0)
         ci->top_left_math_kern_array = xmalloc((unsigned) (2 * (int) sizeof(scaled) * x));
@@ -755,6 +759,8 @@ static void undump_math_kerns(charinfo * ci)
         ci->top_left_math_kern_array[(2 * k) + 1] = (scaled) x;
     }
     undump_int(x);
+    if (!native_undump_size(x, 2 * sizeof(scaled)))
+        x = 0;
     ci->bottom_left_math_kerns = x;
     if (x > 0)
         ci->bottom_left_math_kern_array = xmalloc((unsigned) (2 * (int) sizeof(scaled) * x));
@@ -765,6 +771,8 @@ static void undump_math_kerns(charinfo * ci)
         ci->bottom_left_math_kern_array[(2 * k) + 1] = (scaled) x;
     }
     undump_int(x);
+    if (!native_undump_size(x, 2 * sizeof(scaled)))
+        x = 0;
     ci->top_right_math_kerns = x;
     if (x > 0)
         ci->top_right_math_kern_array = xmalloc((unsigned) (2 * (int) sizeof(scaled) * x));
@@ -775,6 +783,8 @@ static void undump_math_kerns(charinfo * ci)
         ci->top_right_math_kern_array[(2 * k) + 1] = (scaled) x;
     }
     undump_int(x);
+    if (!native_undump_size(x, 2 * sizeof(scaled)))
+        x = 0;
     ci->bottom_right_math_kerns = x;
     if (x > 0)
         ci->bottom_right_math_kern_array = xmalloc((unsigned) (2 * (int) sizeof(scaled) * x));
@@ -1452,7 +1462,6 @@ static void dump_charinfo(int f, int c)
     kerninfo *kern;
     dump_int(c);
     co = char_info(f, c);
-    set_charinfo_used(co, 0);
     dump_int(get_charinfo_width(co));
     dump_int(get_charinfo_height(co));
     dump_int(get_charinfo_depth(co));
@@ -1545,13 +1554,13 @@ static void dump_font_entry(texfont * f)
     dump_int(f->ligatures_disabled);
     dump_int(f->_pdf_font_num);
     dump_int(f->_pdf_font_attr);
+    dump_int(f->_font_units_per_em);
+    dump_int(f->_font_index);
 }
 
-void dump_font(int f)
+static void dump_font_data(int f)
 {
     int i, x;
-    set_font_used(f, 0);
-    font_tables[f]->charinfo_cache = NULL;
     dump_font_entry(font_tables[f]);
     dump_string(font_name(f));
     dump_string(font_area(f));
@@ -1584,6 +1593,30 @@ void dump_font(int f)
     }
 }
 
+static void reset_font_used(int f)
+{
+    int i;
+    set_font_used(f, 0);
+    if (has_left_boundary(f)) {
+        set_charinfo_used(left_boundary(f), 0);
+    }
+    if (has_right_boundary(f)) {
+        set_charinfo_used(right_boundary(f), 0);
+    }
+    for (i = font_bc(f); i <= font_ec(f); i++) {
+        if (quick_char_exists(f, i)) {
+            set_charinfo_used(char_info(f, i), 0);
+        }
+    }
+}
+
+void dump_font(int f)
+{
+    reset_font_used(f);
+    font_tables[f]->charinfo_cache = NULL;
+    dump_font_data(f);
+}
+
 static int undump_charinfo(int f)
 {
     charinfo *co;
@@ -1593,6 +1626,8 @@ static int undump_charinfo(int f)
     kerninfo *kern = NULL;
     eight_bits *packet = NULL;
     undump_int(i);
+    if (!native_undump_sane(proper_char_index(i) || i == left_boundarychar || i == right_boundarychar))
+        i = 0;
     co = get_charinfo(f, i);
     undump_int(x);
     set_charinfo_width(co, x);
@@ -1624,23 +1659,26 @@ static int undump_charinfo(int f)
     set_charinfo_index(co, x);
     /*tex Name */
     undump_int(x);
-    if (x > 0) {
+    if (x > 0 && native_undump_size(x, 1)) {
         font_bytes += x;
         s = xmalloc((unsigned) x);
         undump_things(*s, x);
+        s[x - 1] = 0;
     }
     set_charinfo_name(co, s);
     /*tex Tounicode */
+    s = NULL;
     undump_int(x);
-    if (x > 0) {
+    if (x > 0 && native_undump_size(x, 1)) {
         font_bytes += x;
         s = xmalloc((unsigned) x);
         undump_things(*s, x);
+        s[x - 1] = 0;
     }
     set_charinfo_tounicode(co, s);
     /*tex Ligatures */
     undump_int(x);
-    if (x > 0) {
+    if (x > 0 && native_undump_size(x, sizeof(liginfo))) {
         font_bytes += (int) ((unsigned) x * sizeof(liginfo));
         lig = xmalloc((unsigned) ((unsigned) x * sizeof(liginfo)));
         undump_things(*lig, x);
@@ -1648,7 +1686,7 @@ static int undump_charinfo(int f)
     set_charinfo_ligatures(co, lig);
     /*tex Kerns */
     undump_int(x);
-    if (x > 0) {
+    if (x > 0 && native_undump_size(x, sizeof(kerninfo))) {
         font_bytes += (int) ((unsigned) x * sizeof(kerninfo));
         kern = xmalloc((unsigned) ((unsigned) x * sizeof(kerninfo)));
         undump_things(*kern, x);
@@ -1657,7 +1695,7 @@ static int undump_charinfo(int f)
 
     /*tex Packets */
     undump_int(x);
-    if (x > 0) {
+    if (x > 0 && native_undump_size(x, 1)) {
         font_bytes += x;
         packet = xmalloc((unsigned) x);
         undump_things(*packet, x);
@@ -1673,10 +1711,11 @@ static int undump_charinfo(int f)
 
 #define undump_font_string(a)     \
     undump_int (x);               \
-    if (x>0) {                    \
+    if (x>0 && native_undump_size(x,1)) { \
         font_bytes += x;          \
         s = xmalloc((unsigned)x); \
         undump_things(*s,x);      \
+        s[x-1] = 0;               \
         a(f,s);                   \
     }
 
@@ -1718,6 +1757,8 @@ static void undump_font_entry(texfont * f)
     undump_int(x); f->ligatures_disabled = x;
     undump_int(x); f->_pdf_font_num = x;
     undump_int(x); f->_pdf_font_attr = x;
+    undump_int(x); f->_font_units_per_em = x;
+    undump_int(x); f->_font_index = x;
 }
 
 void undump_font(int f)
@@ -1732,6 +1773,15 @@ void undump_font(int f)
     memset(tt, 0, sizeof(texfont));
     font_bytes += (int) sizeof(texfont);
     undump_font_entry(tt);
+    if (!native_undump_sane(tt->_font_bc >= 0 && tt->_font_ec <= biggest_char
+            && native_undump_size(tt->_font_params + 1, sizeof(scaled))
+            && native_undump_size(tt->_font_math_params + 1, sizeof(scaled)))) {
+        /*tex A damaged font cache; what follows is discarded anyway. */
+        tt->_font_bc = 1;
+        tt->_font_ec = 0;
+        tt->_font_params = 0;
+        tt->_font_math_params = 0;
+    }
     font_tables[f] = tt;
     undump_font_string(set_font_name);
     undump_font_string(set_font_area);
@@ -1754,6 +1804,7 @@ void undump_font(int f)
     }
     /*tex stack size 1, default item value 0 */
     font_tables[f]->characters = new_sa_tree(1, 1, sa_value);
+    font_tables[f]->characters->journaled = 0;
     ci = xcalloc(1, sizeof(charinfo));
     set_charinfo_name(ci, xstrdup(".notdef"));
     font_tables[f]->charinfo = ci;
@@ -1768,11 +1819,175 @@ void undump_font(int f)
         i = undump_charinfo(f);
     }
     i = font_bc(f);
-    while (i < font_ec(f)) {
+    while (i < font_ec(f) && !native_undump_failed()) {
         i = undump_charinfo(f);
     }
 }
 
+/*tex
+
+    A font cache holds one font in the layout of a native format (see
+    |texfileio.c|), so loading it maps the file and copies the data into fresh
+    arrays, like fonts in the format. Its dimensions are those of the size the
+    font was made at; another size is reached by scaling them. Virtual fonts
+    refer to other font ids in their packets so they can't be cached.
+
+*/
+
+#define FONT_CACHE_MAGIC "LTXFNTC1"
+
+boolean dump_font_cache(int f, const char *filename)
+{
+    int x;
+    char *s = NULL;
+    if (!open_native_dump_file(filename, FONT_CACHE_MAGIC))
+        return false;
+    dump_font_data(f);
+    /*tex The attributes are a pool string so we store the text. */
+    if (pdf_font_attr(f) != 0)
+        s = makecstring(pdf_font_attr(f));
+    dump_string(s);
+    xfree(s);
+    close_native_dump_file();
+    return true;
+}
+
+/*tex Unset accents and math parameters have their own values. */
+
+static scaled scale_font_dimension(scaled v, scaled s, scaled z)
+{
+    int64_t d;
+    if (v == INT_MIN || v == undefined_math_parameter)
+        return v;
+    d = (int64_t) v * s;
+    return (scaled) (d < 0 ? (d - z / 2) / z : (d + z / 2) / z);
+}
+
+#define scale_font_field(a) a = scale_font_dimension(a, s, z)
+
+static void scale_font_variants(extinfo * ext, scaled s, scaled z)
+{
+    for (; ext != NULL; ext = ext->next) {
+        scale_font_field(ext->start_overlap);
+        scale_font_field(ext->end_overlap);
+        scale_font_field(ext->advance);
+    }
+}
+
+static void scale_font_math_kerns(scaled * k, int n, scaled s, scaled z)
+{
+    int i;
+    for (i = 0; i < 2 * n; i++) {
+        scale_font_field(k[i]);
+    }
+}
+
+static void scale_charinfo(charinfo * co, scaled s, scaled z)
+{
+    kerninfo *kern;
+    scale_font_field(co->width);
+    scale_font_field(co->height);
+    scale_font_field(co->depth);
+    scale_font_field(co->italic);
+    scale_font_field(co->vert_italic);
+    scale_font_field(co->top_accent);
+    scale_font_field(co->bot_accent);
+    if ((kern = co->kerns) != NULL) {
+        for (; !kern_end(*kern); kern++) {
+            scale_font_field(kern->sc);
+        }
+    }
+    scale_font_variants(co->vert_variants, s, z);
+    scale_font_variants(co->hor_variants, s, z);
+    scale_font_math_kerns(co->top_left_math_kern_array, co->top_left_math_kerns, s, z);
+    scale_font_math_kerns(co->top_right_math_kern_array, co->top_right_math_kerns, s, z);
+    scale_font_math_kerns(co->bottom_left_math_kern_array, co->bottom_left_math_kerns, s, z);
+    scale_font_math_kerns(co->bottom_right_math_kern_array, co->bottom_right_math_kerns, s, z);
+}
+
+/*tex Parameter one is the slant, and some math parameters are percentages. */
+
+static void scale_font_cache(int f, scaled s)
+{
+    int i;
+    scaled z = font_size(f);
+    for (i = 2; i <= font_params(f); i++) {
+        scale_font_field(font_param(f, i));
+    }
+    for (i = 1; i <= font_math_params(f); i++) {
+        switch (i) {
+            case ScriptPercentScaleDown:
+            case ScriptScriptPercentScaleDown:
+            case RadicalDegreeBottomRaisePercent:
+            case NoLimitSubFactor:
+            case NoLimitSupFactor:
+                break;
+            default:
+                scale_font_field(font_math_param(f, i));
+                break;
+        }
+    }
+    if (has_left_boundary(f)) {
+        scale_charinfo(left_boundary(f), s, z);
+    }
+    if (has_right_boundary(f)) {
+        scale_charinfo(right_boundary(f), s, z);
+    }
+    for (i = font_bc(f); i <= font_ec(f); i++) {
+        if (quick_char_exists(f, i)) {
+            scale_charinfo(char_info(f, i), s, z);
+        }
+    }
+    set_font_size(f, s);
+}
+
+/*tex
+
+    A negative size is a scale factor in permille of the design size, zero
+    keeps the cached size. When the file is not a font cache made by this
+    engine, or is damaged, the null font is returned.
+
+*/
+
+internal_font_number undump_font_cache(const char *filename, scaled s)
+{
+    int f, x;
+    char *a = NULL;
+    if (font_tables == NULL || font_tables[0] == NULL) {
+        create_null_font();
+    }
+    if (!open_native_undump_file(filename, FONT_CACHE_MAGIC))
+        return null_font;
+    f = new_font_id();
+    undump_font(f);
+    undump_int(x);
+    if (x > 0 && native_undump_size(x, 1)) {
+        a = xmalloc((unsigned) x);
+        undump_things(*a, x);
+        a[x - 1] = 0;
+    }
+    if (!close_native_undump_file()) {
+        xfree(a);
+        delete_font(f);
+        return null_font;
+    }
+    reset_font_used(f);
+    set_font_touched(f, 0);
+    set_font_cache_id(f, 0);
+    set_pdf_font_num(f, 0);
+    set_pdf_font_attr(f, 0);
+    if (a != NULL) {
+        if (strlen(a) > 0)
+            set_pdf_font_attr(f, maketexstring(a));
+        xfree(a);
+    }
+    if (s < 0)
+        s = scale_font_dimension(font_dsize(f), -s, 1000);
+    if (s > 0 && s != font_size(f))
+        scale_font_cache(f, s);
+    return f;
+}
+
 /* The \PK\ pixel density value from |texmf.cnf| */
 
 int pk_dpi;
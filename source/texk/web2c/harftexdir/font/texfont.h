@@ -617,6 +617,8 @@ boolean is_valid_font(int id);
 
 void dump_font(int font_number);
 void undump_font(int font_number);
+boolean dump_font_cache(int font_number, const char *filename);
+internal_font_number undump_font_cache(const char *filename, scaled s);
 
 int test_no_ligatures(internal_font_number f);
 void set_no_ligatures(internal_font_number f);
@@ -22,6 +22,12 @@ with LuaTeX; if not, see <http://www.gnu.org/licenses/>.
 
 #include "ptexlib.h"
 #include "lua/luatex-api.h"
+#include "md5.h"
+
+#ifndef _WIN32
+#  include <pthread.h>
+#  define FONT_WORKERS 1
+#endif
 
 int t1_wide_mode = 0 ;
 
@@ -440,7 +446,261 @@ blobs, but for the moment we keep the current approach.
 
 */
 
-static void write_fontfile(PDF pdf, fd_entry * fd)
+/*tex
+
+    The dictionary of a font file stream depends on the font type and on some
+    lengths that the subsetters leave behind in globals, so we collect them
+    right after the font program has been generated.
+
+*/
+
+typedef struct {
+    const char *subtype;
+    int nof_lengths;
+    int lengths[3];
+} ff_stream_info;
+
+static void get_fontfile_info(fd_entry * fd, ff_stream_info * info)
+{
+    info->subtype = NULL;
+    info->nof_lengths = 0;
+    if (is_cidkeyed(fd->fm)) {
+        /*tex No subtype is used for |TRUETYPE\ based \OPENTYPE\ fonts. */
+        if (is_opentype(fd->fm)) {
+            info->subtype = "CIDFontType0C";
+        } else if (is_type1(fd->fm)) {
+            if (t1_wide_mode) {
+                info->nof_lengths = 3;
+            } else {
+                info->subtype = "CIDFontType0C";
+            }
+        }
+    } else if (is_type1(fd->fm)) {
+        info->nof_lengths = 3;
+    } else if (is_truetype(fd->fm)) {
+        info->nof_lengths = 1;
+        info->lengths[0] = (int) ttf_length;
+    } else if (is_opentype(fd->fm)) {
+        info->subtype = "Type1C";
+    } else {
+        normal_error("fonts","there is a problem writing the font file (3)");
+    }
+    if (info->nof_lengths == 3) {
+        info->lengths[0] = (int) t1_length1;
+        info->lengths[1] = (int) t1_length2;
+        info->lengths[2] = (int) t1_length3;
+    }
+}
+
+static void write_fontfile_info(PDF pdf, ff_stream_info * info)
+{
+    if (info->subtype != NULL) {
+        pdf_dict_add_name(pdf, "Subtype", info->subtype);
+    }
+    if (info->nof_lengths == 1) {
+        pdf_dict_add_int(pdf, "Length1", info->lengths[0]);
+    } else if (info->nof_lengths == 3) {
+        pdf_dict_add_int(pdf, "Length1", info->lengths[0]);
+        pdf_dict_add_int(pdf, "Length2", info->lengths[1]);
+        pdf_dict_add_int(pdf, "Length3", info->lengths[2]);
+    }
+}
+
+/*tex
+
+    The subsetters keep their state in globals so they have to run one after
+    another, but compressing the resulting font programs is independent work
+    that can take quite some time for large (\CJK) fonts. When |fontworkers|
+    is set and the file is compressed, a finished font program is copied out
+    of |pdf->fb| and handed over to a small pool of threads that deflate it
+    while the next font is being subsetted. The streams are written at the end
+    of |write_fontstuff| in the order in which they were queued, so the file
+    doesn't depend on the scheduling of the threads.
+
+*/
+
+#define MAX_FONT_WORKERS 64
+
+typedef struct ff_job {
+    int objnum;
+    int level;
+    int state;
+    ff_stream_info info;
+    unsigned char *data;
+    size_t size;
+    unsigned char *zdata;
+    size_t zsize;
+    struct ff_job *next;
+} ff_job;
+
+typedef enum {
+    ff_job_queued = 0,
+    ff_job_busy,
+    ff_job_done,
+    ff_job_failed,
+} ff_job_states;
+
+static ff_job *ff_jobs_first = NULL;
+static ff_job *ff_jobs_last = NULL;
+
+#ifdef FONT_WORKERS
+
+static pthread_mutex_t ff_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ff_queued = PTHREAD_COND_INITIALIZER;
+static pthread_t ff_threads[MAX_FONT_WORKERS];
+static int ff_nof_threads = 0;
+static int ff_stopping = 0;
+
+/*tex
+
+    Workers only touch their own job, so no \TEX\ or \PDF\ state is involved;
+    errors are recorded in the job and reported by the main thread.
+
+*/
+
+static void deflate_ff_job(ff_job * job)
+{
+    uLongf zsize = compressBound((uLong) job->size);
+    job->zdata = malloc((size_t) zsize);
+    if (job->zdata != NULL && compress2(job->zdata, &zsize, job->data, (uLong) job->size, job->level) == Z_OK) {
+        job->zsize = (size_t) zsize;
+        job->state = ff_job_done;
+    } else {
+        job->state = ff_job_failed;
+    }
+}
+
+static void *ff_worker(void *arg)
+{
+    ff_job *job;
+    (void) arg;
+    pthread_mutex_lock(&ff_mutex);
+    while (1) {
+        for (job = ff_jobs_first; job != NULL; job = job->next) {
+            if (job->state == ff_job_queued)
+                break;
+        }
+        if (job != NULL) {
+            job->state = ff_job_busy;
+            pthread_mutex_unlock(&ff_mutex);
+            deflate_ff_job(job);
+            pthread_mutex_lock(&ff_mutex);
+        } else if (ff_stopping) {
+            break;
+        } else {
+            pthread_cond_wait(&ff_queued, &ff_mutex);
+        }
+    }
+    pthread_mutex_unlock(&ff_mutex);
+    return NULL;
+}
+
+static void start_font_workers(int n)
+{
+    if (n > MAX_FONT_WORKERS)
+        n = MAX_FONT_WORKERS;
+    ff_stopping = 0;
+    for (ff_nof_threads = 0; ff_nof_threads < n; ff_nof_threads++) {
+        if (pthread_create(&ff_threads[ff_nof_threads], NULL, ff_worker, NULL) != 0)
+            break;
+    }
+}
+
+static void stop_font_workers(void)
+{
+    int i;
+    pthread_mutex_lock(&ff_mutex);
+    ff_stopping = 1;
+    pthread_cond_broadcast(&ff_queued);
+    pthread_mutex_unlock(&ff_mutex);
+    for (i = 0; i < ff_nof_threads; i++)
+        pthread_join(ff_threads[i], NULL);
+    ff_nof_threads = 0;
+}
+
+#endif
+
+static int queue_fontfile(PDF pdf, fd_entry * fd, ff_stream_info * info)
+{
+#ifdef FONT_WORKERS
+    ff_job *job;
+    if (pdf->font_workers <= 0 || pdf->compress_level <= 0)
+        return 0;
+    if (ff_nof_threads == 0) {
+        start_font_workers(pdf->font_workers);
+        if (ff_nof_threads == 0)
+            return 0;
+    }
+    job = xtalloc(1, ff_job);
+    job->objnum = fd->ff_objnum;
+    job->level = pdf->compress_level;
+    job->state = ff_job_queued;
+    job->info = *info;
+    job->size = strbuf_offset(pdf->fb);
+    job->data = xtalloc(job->size > 0 ? job->size : 1, unsigned char);
+    memcpy(job->data, pdf->fb->data, job->size);
+    strbuf_seek(pdf->fb, 0);
+    job->zdata = NULL;
+    job->zsize = 0;
+    job->next = NULL;
+    pthread_mutex_lock(&ff_mutex);
+    if (ff_jobs_last == NULL)
+        ff_jobs_first = job;
+    else
+        ff_jobs_last->next = job;
+    ff_jobs_last = job;
+    pthread_cond_signal(&ff_queued);
+    pthread_mutex_unlock(&ff_mutex);
+    return 1;
+#else
+    (void) pdf;
+    (void) fd;
+    (void) info;
+    return 0;
+#endif
+}
+
+/*tex We flush the queued font file streams in the order they were queued. */
+
+static void write_queued_fontfiles(PDF pdf)
+{
+    ff_job *job;
+    if (ff_jobs_first == NULL)
+        return;
+#ifdef FONT_WORKERS
+    /*tex Telling the workers to stop makes them finish the queue first. */
+    stop_font_workers();
+#endif
+    while (ff_jobs_first != NULL) {
+        job = ff_jobs_first;
+        pdf_begin_obj(pdf, job->objnum, OBJSTM_NEVER);
+        pdf_begin_dict(pdf);
+        write_fontfile_info(pdf, &job->info);
+        if (job->state == ff_job_done) {
+            pdf_dict_add_name(pdf, "Filter", "FlateDecode");
+            pdf_dict_add_int(pdf, "Length", (int) job->zsize);
+            pdf_end_dict(pdf);
+            pdf_begin_stream(pdf);
+            pdf_out_block(pdf, (const char *) job->zdata, job->zsize);
+        } else {
+            /*tex A font program that could not be deflated is still valid as is. */
+            formatted_warning("fonts","compressing font file object %d failed, writing it uncompressed", job->objnum);
+            pdf_dict_add_int(pdf, "Length", (int) job->size);
+            pdf_end_dict(pdf);
+            pdf_begin_stream(pdf);
+            pdf_out_block(pdf, (const char *) job->data, job->size);
+        }
+        pdf_end_stream(pdf);
+        pdf_end_obj(pdf);
+        ff_jobs_first = job->next;
+        xfree(job->data);
+        free(job->zdata);
+        xfree(job);
+    }
+    ff_jobs_last = NULL;
+}
+
+static void write_fontfile_program(PDF pdf, fd_entry * fd)
 {
     if (is_cidkeyed(fd->fm)) {
         if (is_opentype(fd->fm)) {
@@ -470,36 +730,336 @@ static void write_fontfile(PDF pdf, fd_entry * fd)
             normal_error("fonts","there is a problem writing the font file (2)");
         }
     }
-    if (!fd->ff_found)
-        return;
-    fd->ff_objnum = pdf_create_obj(pdf, obj_type_others, 0);
-    /*tex The font file stream: */
-    pdf_begin_obj(pdf, fd->ff_objnum, OBJSTM_NEVER);
+}
+
+/*tex
+
+    Subsetting a large font is expensive, and documents that are processed
+    over and over again often use the same glyphs. When a cache path is set
+    (|pdf.setfontcache|), subsetted \CID\ fonts (\OPENTYPE\ and \TRUETYPE)
+    are stored there, together with the stream dictionary and the metrics that
+    the subsetter picks up from the font file. The name of an entry is a hash
+    of the font file checksum, the glyph set and everything else that
+    influences the subset. The entry also records the size, time stamp and
+    checksum of the font file so that it is only reused when the file didn't
+    change.
+
+    The |/CIDSet| only depends on the glyph set so it is regenerated instead of
+    cached. The widths array and |/ToUnicode| depend on the font as loaded by
+    \LUA\ and are cheap to make so they are always created.
+
+*/
+
+int cidset = 0;
+
+#define FONT_CACHE_MAGIC   "LTXFCACH"
+#define FONT_CACHE_VERSION 1
+
+static char *font_cache_path = NULL;
+
+void set_font_cache_path(const char *s)
+{
+    xfree(font_cache_path);
+    if (s != NULL && *s != '\0')
+        font_cache_path = xstrdup(s);
+}
+
+const char *get_font_cache_path(void)
+{
+    return font_cache_path;
+}
+
+typedef struct fc_file {
+    char *path;
+    long long size;
+    long long mtime;
+    md5_byte_t digest[16];
+    struct fc_file *next;
+} fc_file;
+
+typedef struct {
+    fc_file *file;
+    char *name;
+} fc_entry;
+
+static fc_file *fc_files = NULL;
+
+/*tex We checksum each font file only once per run. */
+
+static fc_file *font_cache_file(const char *path)
+{
+    fc_file *ff;
+    for (ff = fc_files; ff != NULL; ff = ff->next) {
+        if (strcmp(ff->path, path) == 0)
+            return ff;
+    }
+    ff = xtalloc(1, fc_file);
+    if (!get_file_checksum(path, ff->digest, &ff->size, &ff->mtime)) {
+        xfree(ff);
+        return NULL;
+    }
+    ff->path = xstrdup(path);
+    ff->next = fc_files;
+    fc_files = ff;
+    return ff;
+}
+
+static void font_cache_append_int(md5_state_t * state, int i)
+{
+    md5_append(state, (const md5_byte_t *) &i, sizeof(int));
+}
+
+static void font_cache_append_str(md5_state_t * state, const char *s)
+{
+    if (s != NULL)
+        md5_append(state, (const md5_byte_t *) s, (int) strlen(s) + 1);
+    else
+        font_cache_append_int(state, 0);
+}
+
+/*tex This returns |NULL| when the font can't be cached. */
+
+static fc_entry *font_cache_entry(PDF pdf, fd_entry * fd)
+{
+    int i, j;
+    char *path;
+    fc_file *ff;
+    fc_entry *fc;
+    glw_entry *glyph;
+    struct avl_traverser t;
+    md5_state_t state;
+    md5_byte_t digest[16];
+    if (font_cache_path == NULL)
+        return NULL;
+    if (!is_cidkeyed(fd->fm) || !is_subsetted(fd->fm) || !(is_opentype(fd->fm) || is_truetype(fd->fm)))
+        return NULL;
+    if (callback_defined(read_opentype_file_callback) > 0)
+        return NULL;
+    path = luatex_find_file(fd->fm->ff_name, find_opentype_file_callback);
+    if (path == NULL)
+        return NULL;
+    ff = font_cache_file(path);
+    xfree(path);
+    if (ff == NULL)
+        return NULL;
+    md5_init(&state);
+    md5_append(&state, ff->digest, 16);
+    font_cache_append_int(&state, FONT_CACHE_VERSION);
+    font_cache_append_int(&state, (int) fd->fm->type);
+    font_cache_append_int(&state, (int) fd->fm->index);
+    font_cache_append_int(&state, (int) fd->fm->slant);
+    font_cache_append_int(&state, (int) fd->fm->extend);
+    font_cache_append_int(&state, pdf->omit_cidset);
+    font_cache_append_int(&state, pdf->major_version);
+    font_cache_append_str(&state, fd->fm->ps_name);
+    font_cache_append_str(&state, fd->fontname);
+    font_cache_append_str(&state, fd->subset_tag);
+    for (i = 0; i < FONT_KEYS_NUM; i++) {
+        font_cache_append_int(&state, fd->font_dim[i].val);
+        font_cache_append_int(&state, fd->font_dim[i].set);
+    }
+    avl_t_init(&t, fd->gl_tree);
+    for (glyph = (glw_entry *) avl_t_first(&t, fd->gl_tree); glyph != NULL; glyph = (glw_entry *) avl_t_next(&t)) {
+        font_cache_append_int(&state, (int) glyph->id);
+    }
+    md5_finish(&state, digest);
+    fc = xtalloc(1, fc_entry);
+    fc->file = ff;
+    fc->name = xtalloc(strlen(font_cache_path) + 2 + 32 + 4 + 1, char);
+    i = sprintf(fc->name, "%s/", font_cache_path);
+    for (j = 0; j < 16; j++) {
+        i += sprintf(fc->name + i, "%02x", digest[j]);
+    }
+    strcpy(fc->name + i, ".fsc");
+    return fc;
+}
+
+static void free_font_cache_entry(fc_entry * fc)
+{
+    if (fc != NULL) {
+        xfree(fc->name);
+        xfree(fc);
+    }
+}
+
+typedef struct {
+    char magic[8];
+    int version;
+    int subtype;
+    int nof_lengths;
+    int lengths[3];
+    int has_cidset;
+    int is_opentype;
+    long long size;
+    long long mtime;
+    md5_byte_t digest[16];
+    intparm font_dim[FONT_KEYS_NUM];
+    long long length;
+} fc_header;
+
+static const char *fc_subtypes[] = { "", "CIDFontType0C", "Type1C", NULL };
+
+static int font_cache_subtype(const char *s)
+{
+    int i;
+    if (s != NULL) {
+        for (i = 1; fc_subtypes[i] != NULL; i++) {
+            if (strcmp(s, fc_subtypes[i]) == 0)
+                return i;
+        }
+    }
+    return 0;
+}
+
+/*tex
+
+    The |/CIDSet| is the same bit table that the subsetters write: one bit per
+    \CID, high order bit first.
+
+*/
+
+static void write_cached_cidset(PDF pdf, fd_entry * fd)
+{
+    size_t l;
+    char *stream;
+    unsigned last_cid = 0;
+    glw_entry *glyph;
+    struct avl_traverser t;
+    cidset = pdf_create_obj(pdf, obj_type_others, 0);
+    avl_t_init(&t, fd->gl_tree);
+    for (glyph = (glw_entry *) avl_t_first(&t, fd->gl_tree); glyph != NULL; glyph = (glw_entry *) avl_t_next(&t)) {
+        if (glyph->id > last_cid)
+            last_cid = glyph->id;
+    }
+    l = (last_cid / 8) + 1;
+    stream = xmalloc(l);
+    memset(stream, 0, l);
+    avl_t_init(&t, fd->gl_tree);
+    for (glyph = (glw_entry *) avl_t_first(&t, fd->gl_tree); glyph != NULL; glyph = (glw_entry *) avl_t_next(&t)) {
+        if (glyph->id > 0)
+            stream[(glyph->id / 8)] |= (1 << (7 - (glyph->id % 8)));
+    }
+    pdf_begin_obj(pdf, cidset, OBJSTM_NEVER);
     pdf_begin_dict(pdf);
-    if (is_cidkeyed(fd->fm)) {
-        /*tex No subtype is used for |TRUETYPE\ based \OPENTYPE\ fonts. */
-        if (is_opentype(fd->fm)) {
-            pdf_dict_add_name(pdf, "Subtype", "CIDFontType0C");
-        } else if (is_type1(fd->fm)) {
-            if (t1_wide_mode) {
-                pdf_dict_add_int(pdf, "Length1", (int) t1_length1);
-                pdf_dict_add_int(pdf, "Length2", (int) t1_length2);
-                pdf_dict_add_int(pdf, "Length3", (int) t1_length3);
-            } else {
-                pdf_dict_add_name(pdf, "Subtype", "CIDFontType0C");
-            }
+    pdf_dict_add_streaminfo(pdf);
+    pdf_end_dict(pdf);
+    pdf_begin_stream(pdf);
+    pdf_out_block(pdf, stream, l);
+    pdf_end_stream(pdf);
+    pdf_end_obj(pdf);
+    xfree(stream);
+}
+
+static boolean load_cached_fontfile(PDF pdf, fd_entry * fd, fc_entry * fc, ff_stream_info * info)
+{
+    fc_header h;
+    FILE *f = fopen(fc->name, FOPEN_RBIN_MODE);
+    if (f == NULL)
+        return false;
+    if (fread(&h, sizeof(fc_header), 1, f) != 1
+        || memcmp(h.magic, FONT_CACHE_MAGIC, 8) != 0
+        || h.version != FONT_CACHE_VERSION
+        || h.size != fc->file->size
+        || h.mtime != fc->file->mtime
+        || memcmp(h.digest, fc->file->digest, 16) != 0
+        || h.subtype < 0 || h.subtype >= 3
+        || h.length <= 0) {
+        fclose(f);
+        return false;
+    }
+    strbuf_seek(pdf->fb, 0);
+    while (strbuf_offset(pdf->fb) < (size_t) h.length) {
+        int c = getc(f);
+        if (c == EOF) {
+            fclose(f);
+            strbuf_seek(pdf->fb, 0);
+            return false;
         }
-    } else if (is_type1(fd->fm)) {
-        pdf_dict_add_int(pdf, "Length1", (int) t1_length1);
-        pdf_dict_add_int(pdf, "Length2", (int) t1_length2);
-        pdf_dict_add_int(pdf, "Length3", (int) t1_length3);
-    } else if (is_truetype(fd->fm)) {
-        pdf_dict_add_int(pdf, "Length1", (int) ttf_length);
-    } else if (is_opentype(fd->fm)) {
-        pdf_dict_add_name(pdf, "Subtype", "Type1C");
+        strbuf_putchar(pdf->fb, (unsigned char) c);
+    }
+    fclose(f);
+    info->subtype = h.subtype > 0 ? fc_subtypes[h.subtype] : NULL;
+    info->nof_lengths = h.nof_lengths;
+    memcpy(info->lengths, h.lengths, sizeof(h.lengths));
+    memcpy(fd->font_dim, h.font_dim, sizeof(h.font_dim));
+    if (h.is_opentype && is_truetype(fd->fm)) {
+        /*tex The same fallback as in |write_fontfile|. */
+        fd->fm->type |= F_OTF; fd->fm->type ^= F_TRUETYPE;
+    }
+    fd->ff_found = true;
+    if (h.has_cidset) {
+        write_cached_cidset(pdf, fd);
+    }
+    return true;
+}
+
+/*tex
+
+    We write to a temporary file first so that concurrent runs sharing a cache
+    never see a partial entry.
+
+*/
+
+static void save_cached_fontfile(PDF pdf, fd_entry * fd, fc_entry * fc, ff_stream_info * info)
+{
+    fc_header h;
+    FILE *f;
+    char *tmp = xtalloc(strlen(fc->name) + 32, char);
+    memset(&h, 0, sizeof(fc_header));
+    memcpy(h.magic, FONT_CACHE_MAGIC, 8);
+    h.version = FONT_CACHE_VERSION;
+    h.subtype = font_cache_subtype(info->subtype);
+    h.nof_lengths = info->nof_lengths;
+    memcpy(h.lengths, info->lengths, sizeof(h.lengths));
+    h.has_cidset = cidset != 0;
+    h.is_opentype = is_opentype(fd->fm);
+    h.size = fc->file->size;
+    h.mtime = fc->file->mtime;
+    memcpy(h.digest, fc->file->digest, 16);
+    memcpy(h.font_dim, fd->font_dim, sizeof(h.font_dim));
+    h.length = (long long) strbuf_offset(pdf->fb);
+    sprintf(tmp, "%s.%d.tmp", fc->name, (int) getpid());
+    f = fopen(tmp, FOPEN_WBIN_MODE);
+    if (f != NULL) {
+        boolean ok = fwrite(&h, sizeof(fc_header), 1, f) == 1
+            && fwrite(pdf->fb->data, 1, (size_t) h.length, f) == (size_t) h.length;
+        if (fclose(f) == 0 && ok) {
+            remove(fc->name);
+            ok = rename(tmp, fc->name) == 0;
+        }
+        if (!ok) {
+            remove(tmp);
+        }
+    }
+    xfree(tmp);
+}
+
+static void write_fontfile(PDF pdf, fd_entry * fd)
+{
+    ff_stream_info info;
+    fc_entry *fc = font_cache_entry(pdf, fd);
+    if (fc != NULL && load_cached_fontfile(pdf, fd, fc, &info)) {
+        free_font_cache_entry(fc);
+        fc = NULL;
     } else {
-        normal_error("fonts","there is a problem writing the font file (3)");
+        write_fontfile_program(pdf, fd);
+        if (!fd->ff_found) {
+            free_font_cache_entry(fc);
+            return;
+        }
+        get_fontfile_info(fd, &info);
+        if (fc != NULL) {
+            save_cached_fontfile(pdf, fd, fc, &info);
+            free_font_cache_entry(fc);
+        }
     }
+    fd->ff_objnum = pdf_create_obj(pdf, obj_type_others, 0);
+    if (queue_fontfile(pdf, fd, &info))
+        return;
+    /*tex The font file stream: */
+    pdf_begin_obj(pdf, fd->ff_objnum, OBJSTM_NEVER);
+    pdf_begin_dict(pdf);
+    write_fontfile_info(pdf, &info);
     pdf_dict_add_streaminfo(pdf);
     pdf_end_dict(pdf);
     pdf_begin_stream(pdf);
@@ -508,7 +1068,6 @@ static void write_fontfile(PDF pdf, fd_entry * fd)
     pdf_end_obj(pdf);
 }
 
-int cidset = 0;
 
 static void write_fontdescriptor(PDF pdf, fd_entry * fd)
 {
@@ -693,6 +1252,7 @@ void write_fontstuff(PDF pdf)
     write_fontdescriptors(pdf);
     write_fontencodings(pdf);
     write_fontdictionaries(pdf);
+    write_queued_fontfiles(pdf);
 }
 
 static void create_fontdictionary(PDF pdf, internal_font_number f)
@@ -818,3 +818,24 @@ size_t read_file_to_buf(PDF pdf, FILE * f, size_t len)
     }
     return k;
 }
+
+/*tex
+
+    Converted raster images can be kept in a directory so that later runs can
+    reuse them. By default there is no such cache.
+
+*/
+
+static char *image_cache_path = NULL;
+
+void set_image_cache_path(const char *s)
+{
+    xfree(image_cache_path);
+    if (s != NULL && *s != '\0')
+        image_cache_path = xstrdup(s);
+}
+
+const char *get_image_cache_path(void)
+{
+    return image_cache_path;
+}
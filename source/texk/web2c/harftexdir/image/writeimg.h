@@ -48,5 +48,7 @@ void undumpimagemeta(PDF, int, int);
 scaled_whd scan_alt_rule(void);
 size_t read_file_to_buf(PDF pdf, FILE * f, size_t len);
 void pdf_dict_add_img_filename(PDF pdf, image_dict * idict);
+void set_image_cache_path(const char *s);
+const char *get_image_cache_path(void);
 
 #endif
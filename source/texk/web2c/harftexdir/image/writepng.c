@@ -24,6 +24,7 @@ LuaTeX; if not, see <http://www.gnu.org/licenses/>.
 #include <assert.h>
 #include "image/image.h"
 #include "image/writepng.h"
+#include "md5.h"
 
 static void close_and_cleanup_png(image_dict * idict)
 {
@@ -187,9 +188,8 @@ static void write_palette_streamobj(PDF pdf, int palette_objnum, png_colorp pale
     pdf_end_obj(pdf);
 }
 
-static void write_smask_streamobj(PDF pdf, image_dict * idict, int smask_objnum, png_bytep smask, int smask_size)
+static void begin_smask_streamobj(PDF pdf, image_dict * idict, int smask_objnum)
 {
-    int i;
     png_structp png_p = img_png_png_ptr(idict);
     png_infop info_p = img_png_info_ptr(idict);
     png_byte bitdepth = png_get_bit_depth(png_p, info_p);
@@ -204,6 +204,13 @@ static void write_smask_streamobj(PDF pdf, image_dict * idict, int smask_objnum,
     pdf_dict_add_int(pdf, "Height", (int) png_get_image_height(png_p, info_p));
     pdf_dict_add_int(pdf, "BitsPerComponent", (bitdepth == 16 ? 8 : bitdepth));
     pdf_dict_add_name(pdf, "ColorSpace", "DeviceGray");
+}
+
+static void write_smask_streamobj(PDF pdf, image_dict * idict, int smask_objnum, png_bytep smask, int smask_size)
+{
+    int i;
+    png_byte bitdepth = png_get_bit_depth(img_png_png_ptr(idict), img_png_info_ptr(idict));
+    begin_smask_streamobj(pdf, idict, smask_objnum);
     pdf_dict_add_streaminfo(pdf);
     pdf_end_dict(pdf);
     pdf_begin_stream(pdf);
@@ -447,6 +454,187 @@ static void copy_png(PDF pdf, image_dict * idict)
     pdf_end_obj(pdf);
 }
 
+/*tex
+
+    Images that can't be copied are decoded, split into color and alpha and
+    compressed again, which is where most of the time goes for \PNG\ images.
+    When an image cache is set, the resulting streams are kept on disk, keyed by
+    the checksum of the file and the options that influence the conversion, and
+    later runs copy them into the \PDF\ file as they are. The dictionaries only
+    depend on the header so these are always written anew, as is the (small)
+    palette.
+
+*/
+
+#define PNG_CACHE_MAGIC   "LTXICACH"
+#define PNG_CACHE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    int version;
+    int count;
+    int compressed;
+    long long size;
+    long long mtime;
+    md5_byte_t digest[16];
+    long long lengths[2];
+} pc_header;
+
+typedef struct {
+    char *name;
+    pc_header header;
+} pc_entry;
+
+static void png_cache_append_int(md5_state_t * state, int i)
+{
+    md5_append(state, (const md5_byte_t *) &i, sizeof(int));
+}
+
+/*tex This returns |NULL| when there is no cache. */
+
+static pc_entry *png_cache_entry(PDF pdf, image_dict * idict)
+{
+    int i, j;
+    pc_entry *pc;
+    md5_state_t state;
+    md5_byte_t digest[16];
+    const char *path = get_image_cache_path();
+    if (path == NULL)
+        return NULL;
+    pc = xtalloc(1, pc_entry);
+    memset(pc, 0, sizeof(pc_entry));
+    if (!get_file_checksum(img_filepath(idict), pc->header.digest, &pc->header.size, &pc->header.mtime)) {
+        xfree(pc);
+        return NULL;
+    }
+    memcpy(pc->header.magic, PNG_CACHE_MAGIC, 8);
+    pc->header.version = PNG_CACHE_VERSION;
+    pc->header.compressed = pdf->compress_level > 0;
+    md5_init(&state);
+    md5_append(&state, pc->header.digest, 16);
+    png_cache_append_int(&state, PNG_CACHE_VERSION);
+    png_cache_append_int(&state, pdf->minor_version);
+    png_cache_append_int(&state, pdf->compress_level);
+    png_cache_append_int(&state, pdf->image_hicolor);
+    png_cache_append_int(&state, pdf->image_apply_gamma);
+    png_cache_append_int(&state, pdf->image_gamma);
+    png_cache_append_int(&state, pdf->gamma);
+    md5_finish(&state, digest);
+    pc->name = xtalloc(strlen(path) + 2 + 32 + 4 + 1, char);
+    i = sprintf(pc->name, "%s/", path);
+    for (j = 0; j < 16; j++) {
+        i += sprintf(pc->name + i, "%02x", digest[j]);
+    }
+    strcpy(pc->name + i, ".isc");
+    return pc;
+}
+
+static void free_png_cache_entry(pc_entry * pc)
+{
+    if (pc != NULL) {
+        xfree(pc->name);
+        xfree(pc);
+    }
+}
+
+/*tex
+
+    A cached stream is written with an explicit length, there is no need to
+    seek back for it.
+
+*/
+
+static void write_cached_png_stream(PDF pdf, pc_entry * pc, FILE * f, int n)
+{
+    if (pc->header.compressed)
+        pdf_dict_add_name(pdf, "Filter", "FlateDecode");
+    pdf_add_name(pdf, "Length");
+    pdf_printf(pdf, " %" LONGINTEGER_PRI "i", (LONGINTEGER_TYPE) pc->header.lengths[n]);
+    pdf_end_dict(pdf);
+    pdf_begin_stream(pdf);
+    read_file_to_buf(pdf, f, (size_t) pc->header.lengths[n]);
+    pdf_end_stream(pdf);
+    pdf_end_obj(pdf);
+}
+
+/*tex
+
+    We check the whole entry before anything is written, so that a damaged one
+    just falls back to converting the image.
+
+*/
+
+static boolean write_cached_png(PDF pdf, image_dict * idict, pc_entry * pc)
+{
+    pc_header h;
+    off_t length;
+    FILE *f = fopen(pc->name, FOPEN_RBIN_MODE);
+    if (f == NULL)
+        return false;
+    if (fread(&h, sizeof(pc_header), 1, f) != 1
+        || memcmp(&h, &pc->header, offsetof(pc_header, count)) != 0
+        || h.compressed != pc->header.compressed
+        || h.size != pc->header.size
+        || h.mtime != pc->header.mtime
+        || memcmp(h.digest, pc->header.digest, 16) != 0
+        || h.count < 1 || h.count > 2
+        || h.lengths[0] < 0 || h.lengths[1] < 0
+        || fseeko(f, 0, SEEK_END) != 0
+        || (length = ftello(f)) != (off_t) (sizeof(pc_header) + h.lengths[0] + (h.count > 1 ? h.lengths[1] : 0))
+        || fseeko(f, (off_t) sizeof(pc_header), SEEK_SET) != 0) {
+        fclose(f);
+        return false;
+    }
+    pc->header = h;
+    if (h.count > 1) {
+        int smask_objnum = pdf_create_obj(pdf, obj_type_others, 0);
+        pdf_dict_add_ref(pdf, "SMask", (int) smask_objnum);
+        write_cached_png_stream(pdf, pc, f, 0);
+        begin_smask_streamobj(pdf, idict, smask_objnum);
+        write_cached_png_stream(pdf, pc, f, 1);
+    } else {
+        write_cached_png_stream(pdf, pc, f, 0);
+    }
+    fclose(f);
+    return true;
+}
+
+/*tex
+
+    We write to a temporary file first so that concurrent runs sharing a cache
+    never see a partial entry.
+
+*/
+
+static void save_cached_png(pc_entry * pc, stream_capture * c)
+{
+    int i;
+    FILE *f;
+    char *tmp;
+    if (c->overflow || c->capturing || c->count < 1 || c->count > 2)
+        return;
+    pc->header.count = c->count;
+    for (i = 0; i < c->count; i++) {
+        pc->header.lengths[i] = (long long) c->lengths[i];
+    }
+    tmp = xtalloc(strlen(pc->name) + 32, char);
+    sprintf(tmp, "%s.%d.tmp", pc->name, (int) getpid());
+    f = fopen(tmp, FOPEN_WBIN_MODE);
+    if (f != NULL) {
+        size_t n = strbuf_offset(c->data);
+        boolean ok = fwrite(&pc->header, sizeof(pc_header), 1, f) == 1
+            && fwrite(c->data->data, 1, n, f) == n;
+        if (fclose(f) == 0 && ok) {
+            remove(pc->name);
+            ok = rename(tmp, pc->name) == 0;
+        }
+        if (!ok) {
+            remove(tmp);
+        }
+    }
+    xfree(tmp);
+}
+
 static void reopen_png(image_dict * idict)
 {
     int width, height, xres, yres;
@@ -476,6 +664,8 @@ void write_png(PDF pdf, image_dict * idict)
     png_structp png_p;
     png_infop info_p;
     png_colorp palette;
+    pc_entry *pc;
+    stream_capture *capture = NULL;
     assert(idict != NULL);
     if (img_file(idict) == NULL)
         reopen_png(idict);
@@ -603,27 +793,38 @@ void write_png(PDF pdf, image_dict * idict)
             if (png_get_valid(png_p, info_p, PNG_INFO_sPLT))
                 normal_warning("pngcopy","skipped because of sPLT");
         }
-        switch (png_get_color_type(png_p, info_p)) {
-            case PNG_COLOR_TYPE_PALETTE:
-            case PNG_COLOR_TYPE_GRAY:
-            case PNG_COLOR_TYPE_RGB:
-                write_png_gray(pdf, idict);
-                break;
-            case PNG_COLOR_TYPE_GRAY_ALPHA:
-                if (pdf->minor_version >= 4) {
-                    write_png_gray_alpha(pdf, idict);
-                } else
-                    write_png_gray(pdf, idict);
-                break;
-            case PNG_COLOR_TYPE_RGB_ALPHA:
-                if (pdf->minor_version >= 4) {
-                    write_png_rgb_alpha(pdf, idict);
-                } else
+        pc = png_cache_entry(pdf, idict);
+        if (pc == NULL || !write_cached_png(pdf, idict, pc)) {
+            if (pc != NULL)
+                capture = pdf_begin_capture(pdf);
+            switch (png_get_color_type(png_p, info_p)) {
+                case PNG_COLOR_TYPE_PALETTE:
+                case PNG_COLOR_TYPE_GRAY:
+                case PNG_COLOR_TYPE_RGB:
                     write_png_gray(pdf, idict);
-                break;
-            default:
-                assert(0);
+                    break;
+                case PNG_COLOR_TYPE_GRAY_ALPHA:
+                    if (pdf->minor_version >= 4) {
+                        write_png_gray_alpha(pdf, idict);
+                    } else
+                        write_png_gray(pdf, idict);
+                    break;
+                case PNG_COLOR_TYPE_RGB_ALPHA:
+                    if (pdf->minor_version >= 4) {
+                        write_png_rgb_alpha(pdf, idict);
+                    } else
+                        write_png_gray(pdf, idict);
+                    break;
+                default:
+                    assert(0);
+            }
+            if (capture != NULL) {
+                pdf_end_capture(pdf);
+                save_cached_png(pc, capture);
+                pdf_free_capture(capture);
+            }
         }
+        free_png_cache_entry(pc);
     }
     write_palette_streamobj(pdf, palette_objnum, palette, num_palette);
     /*tex always */
@@ -29,6 +29,38 @@ int function_callback_count = 0;
 
 int callback_set[total_callbacks] = { 0 };
 
+/*tex
+
+    Next to the table in the registry that \LUA\ sees we keep a registry
+    reference per registered function, so that fetching a callback is a single
+    indexed lookup.
+
+*/
+
+static int callback_refs[total_callbacks] = { 0 };
+
+/*tex
+
+    When profiling is enabled every callback, saved callback and \LUA\ chunk
+    run from \TEX\ accumulates its number of calls, the (inclusive) wall time
+    spent and the change in the size of the \LUA\ heap.
+
+*/
+
+typedef struct callback_profile_entry {
+    int count;
+    double time;
+    long memory;
+} callback_profile_entry;
+
+int callback_profiling = 0;
+
+static callback_profile_entry callback_profile_data[total_profile_slots];
+
+static const char *const profile_slot_names[] = {
+    "directlua", "latelua", "luafunction", "saved_callback"
+};
+
 /* See also callback_callback_type in luatexcallbackids.h: they must have the same order ! */
 
 static const char *const callbacknames[] = {
@@ -206,6 +238,80 @@ void get_saved_lua_string(int r, const char *name, char **target)
 #define CALLBACK_NODE           'N'
 #define CALLBACK_DIR            'D'
 
+/*tex
+
+    The |values| signatures are string constants at the call sites. They are
+    parsed once into a descriptor that is cached by address, so that running a
+    callback only has to walk the argument and result types.
+
+*/
+
+#define CALLBACK_MAX_VALUES 16
+#define CALLBACK_SIGNATURES 64
+
+typedef struct callback_signature {
+    const char *values;
+    int narg;
+    int nres;
+    char args[CALLBACK_MAX_VALUES];
+    char results[CALLBACK_MAX_VALUES];
+} callback_signature;
+
+static callback_signature callback_signatures[CALLBACK_SIGNATURES];
+
+static void compile_callback_signature(const char *values, callback_signature *sig)
+{
+    const char *s = values;
+    sig->values = values;
+    sig->narg = 0;
+    sig->nres = 0;
+    for (; *s && *s != '>'; s++) {
+        switch (*s) {
+            case CALLBACK_BOOLEAN:
+            case CALLBACK_INTEGER:
+            case CALLBACK_LINE:
+            case CALLBACK_STRNUMBER:
+            case CALLBACK_STRING:
+            case CALLBACK_CHARNUM:
+            case CALLBACK_LSTRING:
+            case CALLBACK_NODE:
+            case CALLBACK_DIR:
+                if (sig->narg == CALLBACK_MAX_VALUES)
+                    normal_error("callback", "too many arguments in signature");
+                sig->args[sig->narg++] = *s;
+                break;
+            default:
+                break;
+        }
+    }
+    if (*s == '>') {
+        for (s++; *s; s++) {
+            if (sig->nres == CALLBACK_MAX_VALUES)
+                normal_error("callback", "too many results in signature");
+            sig->results[sig->nres++] = *s;
+        }
+    }
+}
+
+static const callback_signature *callback_signature_of(const char *values, callback_signature *local)
+{
+    unsigned h = (unsigned) (((size_t) values >> 3) % CALLBACK_SIGNATURES);
+    unsigned n;
+    for (n = 0; n < CALLBACK_SIGNATURES; n++) {
+        callback_signature *sig = &callback_signatures[h];
+        if (sig->values == values) {
+            return sig;
+        } else if (sig->values == NULL) {
+            compile_callback_signature(values, sig);
+            return sig;
+        }
+        h = (h + 1) % CALLBACK_SIGNATURES;
+    }
+    /*tex The cache is full, which only happens with computed signatures. */
+    compile_callback_signature(values, local);
+    return local;
+}
+
 int run_saved_callback(int r, const char *name, const char *values, ...)
 {
     va_list args;
@@ -217,25 +323,99 @@ int run_saved_callback(int r, const char *name, const char *values, ...)
     lua_pushstring(Luas, name);
     lua_rawget(Luas, -2);
     if (lua_isfunction(Luas, -1)) {
+        callback_profile_mark m;
         saved_callback_count++;
+        callback_profile_start(&m);
         ret = do_run_callback(2, values, args);
+        callback_profile_stop(profile_saved_callback, &m);
     }
     va_end(args);
     lua_settop(Luas, stacktop);
     return ret;
 }
 
+static const char *profile_slot_name(int i)
+{
+    return i < total_callbacks ? callbacknames[i] : profile_slot_names[i - total_callbacks];
+}
+
+void callback_profile_start(callback_profile_mark *m)
+{
+    m->started = callback_profiling;
+    if (m->started) {
+        get_seconds_and_micros(&m->seconds, &m->micros);
+        m->bytes = luastate_bytes;
+    }
+}
+
+void callback_profile_stop(int i, callback_profile_mark *m)
+{
+    if (callback_profiling && m->started) {
+        int seconds, micros;
+        callback_profile_entry *e = &callback_profile_data[i];
+        get_seconds_and_micros(&seconds, &micros);
+        e->count++;
+        e->time += (seconds - m->seconds) + (micros - m->micros) / 1000000.0;
+        e->memory += luastate_bytes - m->bytes;
+    }
+}
+
+void callback_profile_report(FILE * f)
+{
+    int order[total_profile_slots];
+    int i, j, n = 0;
+    for (i = 1; i < total_profile_slots; i++) {
+        if (callback_profile_data[i].count > 0) {
+            /*tex Insert sorted on time, the list is short. */
+            for (j = n++; j > 0 && callback_profile_data[order[j - 1]].time < callback_profile_data[i].time; j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+        }
+    }
+    if (n > 0) {
+        fprintf(f, "\nLua callback profile (calls, seconds, heap delta in bytes):\n");
+        for (j = 0; j < n; j++) {
+            callback_profile_entry *e = &callback_profile_data[order[j]];
+            fprintf(f, " %s: %d, %.6f, %ld\n", profile_slot_name(order[j]), e->count, e->time, e->memory);
+        }
+    }
+}
+
+/*tex
+
+    The node filters push their own arguments and call the function that
+    |get_callback| leaves on the stack, so while profiling we hand them a
+    closure that does the bookkeeping around the real function.
+
+*/
+
+static int profiled_callback(lua_State * L)
+{
+    callback_profile_mark m;
+    int n = lua_gettop(L);
+    luaL_checkstack(L, 1, "out of stack space");
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    callback_profile_start(&m);
+    lua_call(L, n, LUA_MULTRET);
+    callback_profile_stop((int) lua_tointeger(L, lua_upvalueindex(2)), &m);
+    return lua_gettop(L);
+}
+
 boolean get_callback(lua_State * L, int i)
 {
-    luaL_checkstack(L, 2, "out of stack space");
-    lua_rawgeti(L, LUA_REGISTRYINDEX, callback_callbacks_id);
-    lua_rawgeti(L, -1, i);
-    if (lua_isfunction(L, -1)) {
-        callback_count++;
-        return true;
-    } else {
+    if (i <= 0 || i >= total_callbacks || callback_refs[i] == 0) {
         return false;
     }
+    luaL_checkstack(L, 2, "out of stack space");
+    lua_rawgeti(L, LUA_REGISTRYINDEX, callback_refs[i]);
+    if (callback_profiling) {
+        lua_pushinteger(L, i);
+        lua_pushcclosure(L, profiled_callback, 2);
+    }
+    callback_count++;
+    return true;
 }
 
 int run_and_save_callback(int i, const char *values, ...)
@@ -255,6 +435,72 @@ int run_and_save_callback(int i, const char *values, ...)
     return ret;
 }
 
+static int callback_pcall(int narg, int nres)
+{
+    int i;
+    lua_active++;
+    i = lua_pcall(Luas, narg, nres, 0);
+    lua_active--;
+    if (i != 0) {
+        /* Can't be more precise here, could be called before
+         * TeX initialization is complete
+         */
+        if (!log_opened_global) {
+            fprintf(stderr, "error in callback: %s\n", lua_tostring(Luas, -1));
+            error();
+        } else {
+            lua_gc(Luas, LUA_GCCOLLECT, 0);
+            luatex_error(Luas, (i == LUA_ERRRUN ? 0 : 1));
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static int callback_line_result(int n, int *bufloc)
+{
+    size_t len;
+    int t = lua_type(Luas, n);
+    if (t == LUA_TSTRING) {
+        const char *s = lua_tolstring(Luas, n, &len);
+        if (s != NULL && len > 0) {
+            int ret = *bufloc;
+            check_buffer_overflow(ret + (int) len);
+            strncpy((char *) (buffer + ret), s, len);
+            *bufloc += (int) len;
+            while ((*bufloc) - 1 > ret && buffer[(*bufloc) - 1] == ' ')
+                (*bufloc)--;
+        }
+        return 1;
+    } else if (t != LUA_TNIL) {
+        fprintf(stderr, "callback should return a string, not: %s\n", lua_typename(Luas, t));
+    }
+    return 0;
+}
+
+/*tex
+
+    The |process_input_buffer| callback runs for every line that is read, so
+    it has its own entry that skips the |va_list| round trip. It behaves like
+    |run_callback(i, "l->l", len, bufloc)|.
+
+*/
+
+int run_line_callback(int i, int len, int *bufloc)
+{
+    int ret = 0;
+    int stacktop = lua_gettop(Luas);
+    if (get_callback(Luas, i)) {
+        luaL_checkstack(Luas, 1, "out of stack space");
+        lua_pushlstring(Luas, (char *) (buffer + first), (size_t) len);
+        if (callback_pcall(1, 1)) {
+            ret = callback_line_result(-1, bufloc);
+        }
+    }
+    lua_settop(Luas, stacktop);
+    return ret;
+}
+
 int run_callback(int i, const char *values, ...)
 {
     va_list args;
@@ -271,24 +517,22 @@ int run_callback(int i, const char *values, ...)
 
 int do_run_callback(int special, const char *values, va_list vl)
 {
-    int ret;
     size_t len;
-    int narg, nres;
+    int narg, nres, k;
     const char *s;
     lstring *lstr;
     char cs;
-    int *bufloc;
     char *ss = NULL;
     int retval = 0;
+    callback_signature local;
+    const callback_signature *sig = callback_signature_of(values, &local);
     if (special == 2) {         /* copy the enclosing table */
         luaL_checkstack(Luas, 1, "out of stack space");
         lua_pushvalue(Luas, -2);
     }
-    ss = strchr(values, '>');
-    luaL_checkstack(Luas, (int) (ss - values + 1), "out of stack space");
-    ss = NULL;
-    for (narg = 0; *values; narg++) {
-        switch (*values++) {
+    luaL_checkstack(Luas, sig->narg + 1, "out of stack space");
+    for (k = 0; k < sig->narg; k++) {
+        switch (sig->args[k]) {
             case CALLBACK_CHARNUM: /* an ascii char! */
                 cs = (char) va_arg(vl, int);
                 lua_pushlstring(Luas, &cs, 1);
@@ -320,52 +564,30 @@ int do_run_callback(int special, const char *values, va_list vl)
             case CALLBACK_DIR:
                 lua_push_dir_par(Luas, va_arg(vl, int));
                 break;
-            case '-':
-                narg--;
-                break;
-            case '>':
-                goto ENDARGS;
             default:
                 ;
         }
     }
-  ENDARGS:
-    nres = (int) strlen(values);
+    narg = sig->narg;
+    nres = sig->nres;
     if (special == 1) {
         nres++;
     }
     if (special == 2) {
         narg++;
     }
-    {
-        int i;
-        lua_active++;
-        i = lua_pcall(Luas, narg, nres, 0);
-        lua_active--;
-        /* lua_remove(L, base); *//* remove traceback function */
-        if (i != 0) {
-            /* Can't be more precise here, could be called before
-             * TeX initialization is complete
-             */
-            if (!log_opened_global) {
-                fprintf(stderr, "error in callback: %s\n", lua_tostring(Luas, -1));
-                error();
-            } else {
-                lua_gc(Luas, LUA_GCCOLLECT, 0);
-                luatex_error(Luas, (i == LUA_ERRRUN ? 0 : 1));
-            }
-            return 0;
-        }
+    if (!callback_pcall(narg, nres)) {
+        return 0;
     }
     if (nres == 0) {
         return 1;
     }
     nres = -nres;
-    while (*values) {
+    for (k = 0; k < sig->nres; k++) {
         int b, t;
         halfword p;
         t = lua_type(Luas, nres);
-        switch (*values++) {
+        switch (sig->results[k]) {
             case CALLBACK_BOOLEAN:
                 if (t == LUA_TNIL) {
                     b = 0;
@@ -386,27 +608,7 @@ int do_run_callback(int special, const char *values, va_list vl)
                 *va_arg(vl, int *) = b;
                 break;
             case CALLBACK_LINE:    /* TeX line ... happens frequently when we have a plug-in */
-                if (t == LUA_TNIL) {
-                    bufloc = 0;
-                    goto EXIT;
-                } else if (t == LUA_TSTRING) {
-                    s = lua_tolstring(Luas, nres, &len);
-                    if (s == NULL) {    /* |len| can be zero */
-                        bufloc = 0;
-                    } else if (len == 0) {
-                        bufloc = 0;
-                    } else {
-                        bufloc = va_arg(vl, int *);
-                        ret = *bufloc;
-                        check_buffer_overflow(ret + (int) len);
-                        strncpy((char *) (buffer + ret), s, len);
-                        *bufloc += (int) len;
-                        /* while (len--) {  buffer[(*bufloc)++] = *s++; } */
-                        while ((*bufloc) - 1 > ret && buffer[(*bufloc) - 1] == ' ')
-                            (*bufloc)--;
-                    }
-                } else {
-                    fprintf(stderr, "callback should return a string, not: %s\n", lua_typename(Luas, t));
+                if (!callback_line_result(nres, va_arg(vl, int *))) {
                     goto EXIT;
                 }
                 break;
@@ -539,6 +741,14 @@ static int callback_register(lua_State * L)
     lua_pushvalue(L, 2);        /* the function or nil */
     lua_rawseti(L, -2, cb);
     lua_rawseti(L, LUA_REGISTRYINDEX, callback_callbacks_id);
+    if (callback_refs[cb] != 0) {
+        luaL_unref(L, LUA_REGISTRYINDEX, callback_refs[cb]);
+        callback_refs[cb] = 0;
+    }
+    if (t2 == LUA_TFUNCTION) {
+        lua_pushvalue(L, 2);
+        callback_refs[cb] = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
     lua_pushinteger(L, cb);
     return 1;
 }
@@ -585,10 +795,37 @@ static int callback_listf(lua_State * L)
     return 1;
 }
 
+static int callback_profile(lua_State * L)
+{
+    int i;
+    if (lua_type(L, 1) == LUA_TBOOLEAN) {
+        lua_pushboolean(L, callback_profiling);
+        callback_profiling = lua_toboolean(L, 1);
+        return 1;
+    }
+    luaL_checkstack(L, 3, "out of stack space");
+    lua_newtable(L);
+    for (i = 1; i < total_profile_slots; i++) {
+        callback_profile_entry *e = &callback_profile_data[i];
+        if (e->count > 0) {
+            lua_createtable(L, 0, 3);
+            lua_pushinteger(L, e->count);
+            lua_setfield(L, -2, "count");
+            lua_pushnumber(L, e->time);
+            lua_setfield(L, -2, "time");
+            lua_pushinteger(L, e->memory);
+            lua_setfield(L, -2, "memory");
+            lua_setfield(L, -2, profile_slot_name(i));
+        }
+    }
+    return 1;
+}
+
 static const struct luaL_Reg callbacklib[] = {
     {"find", callback_find},
     {"register", callback_register},
     {"list", callback_listf},
+    {"profile", callback_profile},
     {NULL, NULL}                /* sentinel */
 };
 
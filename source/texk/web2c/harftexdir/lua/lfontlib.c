@@ -234,6 +234,35 @@ static int deffont(lua_State * L)
     return 0;                   /* not reached */
 }
 
+/* font.dump_cache(id,filename) */
+/* font.load_cache(filename[,size]) */
+
+static int dumpcache(lua_State * L)
+{
+    int i = luaL_checkinteger(L, 1);
+    const char *s = luaL_checkstring(L, 2);
+    if ((i <= 0) || ! is_valid_font(i)) {
+        luaL_error(L, "expected a valid font id");
+    } else if (font_type(i) == virtual_font_type) {
+        luaL_error(L, "virtual fonts can't be cached");
+    }
+    lua_pushboolean(L, dump_font_cache(i, s));
+    return 1;
+}
+
+static int loadcache(lua_State * L)
+{
+    const char *s = luaL_checkstring(L, 1);
+    scaled z = (scaled) luaL_optinteger(L, 2, 0);
+    int i = undump_font_cache(s, z);
+    if (i > 0) {
+        lua_pushinteger(L, i);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
 /* this returns the expected (!) next fontid. */
 /* first arg true will keep the id */
 
@@ -298,6 +327,8 @@ static const struct luaL_Reg fontlib[] = {
     {"addcharacters", addcharacters},
     {"setexpansion", setexpansion},
     {"define", deffont},
+    {"dump_cache", dumpcache},
+    {"load_cache", loadcache},
     {"nextid", nextfontid},
     {"id", getfontid},
     {"frozen", frozenfont},
@@ -44,6 +44,447 @@ char *get_lua_name(int i)
     return luanames[i];
 }
 
+/*
+    Values marked with |lua.setdumped| are serialized into the format. Tables
+    (with strings, numbers, booleans, tables and \LUA\ functions as keys and
+    values) are written depth first, a table or string that was seen before
+    becomes a back reference. Functions are stored as bytecode; upvalues
+    other than |_ENV| are lost. Numbers are written little endian so that the
+    format stays portable, bytecode is not.
+
+    After loading the format the serialized values are kept as they are and
+    only turned into \LUA\ values when they are asked for.
+*/
+
+#define DUMPED_VALUES "lua.dumped"
+#define DUMPED_MODULES "lua.dumped.modules"
+
+#define DUMPED_FALSE    'F'
+#define DUMPED_TRUE     'T'
+#define DUMPED_INTEGER  'i'
+#define DUMPED_NUMBER   'n'
+#define DUMPED_STRING   's'
+#define DUMPED_TABLE    't'
+#define DUMPED_END      'e'
+#define DUMPED_REFERENCE 'r'
+#define DUMPED_FUNCTION 'f'
+
+typedef struct {
+    char *name;
+    int module;
+    unsigned char *buf;
+    int size;
+} dumped_value;
+
+static dumped_value *dumped_values = NULL;
+static int dumped_value_count = 0;
+
+static void dumped_add(bytecode * b, const void *s, int n)
+{
+    if (b->size + n > b->alloc) {
+        b->alloc = b->size + n + LOAD_BUF_SIZE;
+        b->buf = xrealloc(b->buf, (unsigned) b->alloc);
+    }
+    memcpy(b->buf + b->size, s, (size_t) n);
+    b->size += n;
+}
+
+static void dumped_add_tag(bytecode * b, int tag)
+{
+    unsigned char c = (unsigned char) tag;
+    dumped_add(b, &c, 1);
+}
+
+static void dumped_add_uint64(bytecode * b, uint64_t u)
+{
+    unsigned char c[8];
+    int i;
+    for (i = 0; i < 8; i++) {
+        c[i] = (unsigned char) (u >> (8 * i));
+    }
+    dumped_add(b, c, 8);
+}
+
+static int dumped_writer(lua_State * L, const void *p, size_t size, void *B)
+{
+    (void) L;
+    dumped_add((bytecode *) B, p, (int) size);
+    return 0;
+}
+
+/*
+    The stack index |seen| holds a table that maps the tables and strings
+    written so far onto their number, |count| is the last number used.
+*/
+
+static void serialize_value(lua_State * L, int i, bytecode * b, int seen, int *count)
+{
+    int t = lua_type(L, i);
+    luaL_checkstack(L, 3, "out of stack space");
+    switch (t) {
+        case LUA_TBOOLEAN:
+            dumped_add_tag(b, lua_toboolean(L, i) ? DUMPED_TRUE : DUMPED_FALSE);
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, i)) {
+                dumped_add_tag(b, DUMPED_INTEGER);
+                dumped_add_uint64(b, (uint64_t) lua_tointeger(L, i));
+            } else {
+                lua_Number n = lua_tonumber(L, i);
+                uint64_t u;
+                memcpy(&u, &n, sizeof(u));
+                dumped_add_tag(b, DUMPED_NUMBER);
+                dumped_add_uint64(b, u);
+            }
+            break;
+        case LUA_TSTRING:
+            lua_pushvalue(L, i);
+            lua_rawget(L, seen);
+            if (lua_type(L, -1) == LUA_TNUMBER) {
+                dumped_add_tag(b, DUMPED_REFERENCE);
+                dumped_add_uint64(b, (uint64_t) lua_tointeger(L, -1));
+                lua_pop(L, 1);
+            } else {
+                size_t l;
+                const char *str = lua_tolstring(L, i, &l);
+                lua_pop(L, 1);
+                lua_pushvalue(L, i);
+                lua_pushinteger(L, ++(*count));
+                lua_rawset(L, seen);
+                dumped_add_tag(b, DUMPED_STRING);
+                dumped_add_uint64(b, (uint64_t) l);
+                dumped_add(b, str, (int) l);
+            }
+            break;
+        case LUA_TTABLE:
+            lua_pushvalue(L, i);
+            lua_rawget(L, seen);
+            if (lua_type(L, -1) == LUA_TNUMBER) {
+                dumped_add_tag(b, DUMPED_REFERENCE);
+                dumped_add_uint64(b, (uint64_t) lua_tointeger(L, -1));
+                lua_pop(L, 1);
+            } else {
+                lua_pop(L, 1);
+                lua_pushvalue(L, i);
+                lua_pushinteger(L, ++(*count));
+                lua_rawset(L, seen);
+                {
+                    /* sizes, so that the table can be created in one go */
+                    size_t narr = lua_rawlen(L, i);
+                    size_t nall = 0;
+                    lua_pushnil(L);
+                    while (lua_next(L, i)) {
+                        nall++;
+                        lua_pop(L, 1);
+                    }
+                    dumped_add_tag(b, DUMPED_TABLE);
+                    dumped_add_uint64(b, (uint64_t) narr);
+                    dumped_add_uint64(b, (uint64_t) (nall > narr ? nall - narr : 0));
+                }
+                lua_pushnil(L);
+                while (lua_next(L, i)) {
+                    int top = lua_gettop(L);
+                    serialize_value(L, top - 1, b, seen, count);
+                    serialize_value(L, top, b, seen, count);
+                    lua_pop(L, 1);
+                }
+                dumped_add_tag(b, DUMPED_END);
+            }
+            break;
+        case LUA_TFUNCTION:
+            if (lua_iscfunction(L, i)) {
+                luaL_error(L, "C functions can't be dumped");
+            } else {
+                bytecode f = { NULL, 0, 0 };
+                lua_pushvalue(L, i);
+#if LUA_VERSION_NUM == 503
+                lua_dump(L, dumped_writer, (void *) &f, 0);
+#else
+                lua_dump(L, dumped_writer, (void *) &f);
+#endif
+                lua_pop(L, 1);
+                dumped_add_tag(b, DUMPED_FUNCTION);
+                dumped_add_uint64(b, (uint64_t) f.size);
+                dumped_add(b, f.buf, f.size);
+                xfree(f.buf);
+            }
+            break;
+        default:
+            luaL_error(L, "values of type %s can't be dumped", lua_typename(L, t));
+    }
+}
+
+static int serialize_entry(lua_State * L)
+{
+    bytecode *b = (bytecode *) lua_touserdata(L, 1);
+    int count = 0;
+    lua_newtable(L);
+    serialize_value(L, 2, b, lua_gettop(L), &count);
+    return 0;
+}
+
+static uint64_t restore_uint64(lua_State * L, const unsigned char **p, const unsigned char *e)
+{
+    uint64_t u = 0;
+    int i;
+    if (e - *p < 8) {
+        luaL_error(L, "corrupt dumped value");
+    }
+    for (i = 0; i < 8; i++) {
+        u |= (uint64_t) (*p)[i] << (8 * i);
+    }
+    *p += 8;
+    return u;
+}
+
+static const char *restore_reader(lua_State * L, void *ud, size_t * size)
+{
+    bytecode *b = (bytecode *) ud;
+    (void) L;
+    *size = (size_t) b->size;
+    b->size = 0;
+    return (const char *) b->buf;
+}
+
+/* the stack index |tables| holds the |count| tables and strings restored so far, in order */
+
+static void restore_value(lua_State * L, const unsigned char **p, const unsigned char *e, int tables, int *count)
+{
+    uint64_t u;
+    luaL_checkstack(L, 3, "out of stack space");
+    if (*p >= e) {
+        luaL_error(L, "corrupt dumped value");
+    }
+    switch (*(*p)++) {
+        case DUMPED_FALSE:
+            lua_pushboolean(L, 0);
+            break;
+        case DUMPED_TRUE:
+            lua_pushboolean(L, 1);
+            break;
+        case DUMPED_INTEGER:
+            lua_pushinteger(L, (lua_Integer) restore_uint64(L, p, e));
+            break;
+        case DUMPED_NUMBER:
+            {
+                lua_Number n;
+                u = restore_uint64(L, p, e);
+                memcpy(&n, &u, sizeof(n));
+                lua_pushnumber(L, n);
+            }
+            break;
+        case DUMPED_STRING:
+            u = restore_uint64(L, p, e);
+            if ((uint64_t) (e - *p) < u) {
+                luaL_error(L, "corrupt dumped value");
+            }
+            lua_pushlstring(L, (const char *) *p, (size_t) u);
+            *p += u;
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, tables, ++(*count));
+            break;
+        case DUMPED_REFERENCE:
+            lua_rawgeti(L, tables, (lua_Integer) restore_uint64(L, p, e));
+            break;
+        case DUMPED_TABLE:
+            {
+                uint64_t narr = restore_uint64(L, p, e);
+                uint64_t nhash = restore_uint64(L, p, e);
+                if (narr > (uint64_t) (e - *p) || nhash > (uint64_t) (e - *p)) {
+                    luaL_error(L, "corrupt dumped value");
+                }
+                lua_createtable(L, (int) narr, (int) nhash);
+            }
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, tables, ++(*count));
+            while (*p < e && **p != DUMPED_END) {
+                restore_value(L, p, e, tables, count);
+                restore_value(L, p, e, tables, count);
+                lua_rawset(L, -3);
+            }
+            if (*p >= e) {
+                luaL_error(L, "corrupt dumped value");
+            }
+            (*p)++;
+            break;
+        case DUMPED_FUNCTION:
+            {
+                bytecode f;
+                const char *name;
+                int n;
+                u = restore_uint64(L, p, e);
+                if ((uint64_t) (e - *p) < u) {
+                    luaL_error(L, "corrupt dumped value");
+                }
+                f.buf = (unsigned char *) *p;
+                f.size = (int) u;
+                if (lua_load(L, restore_reader, (void *) &f, "=[dumped]", "b")) {
+                    lua_error(L);
+                }
+                *p += u;
+                /*
+                    |lua_load| sets the first upvalue to the globals which is
+                    only right when that upvalue is |_ENV|.
+                */
+                for (n = 1; (name = lua_getupvalue(L, -1, n)) != NULL; n++) {
+                    lua_pop(L, 1);
+                    if (strcmp(name, "_ENV") == 0) {
+                        lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+                    } else {
+                        lua_pushnil(L);
+                    }
+                    lua_setupvalue(L, -2, n);
+                }
+            }
+            break;
+        default:
+            luaL_error(L, "corrupt dumped value");
+    }
+}
+
+/* restores entry |k| and stores it in the table at the top of the stack */
+
+static void restore_dumped(lua_State * L, int k)
+{
+    dumped_value *d = &dumped_values[k];
+    const unsigned char *p = d->buf;
+    int count = 0;
+    lua_newtable(L);
+    restore_value(L, &p, d->buf + d->size, lua_gettop(L), &count);
+    lua_remove(L, -2);
+    lua_setfield(L, -2, d->name);
+    xfree(d->buf);
+    xfree(d->name);
+    *d = dumped_values[--dumped_value_count];
+}
+
+static int find_dumped(const char *name)
+{
+    int k;
+    for (k = 0; k < dumped_value_count; k++) {
+        if (strcmp(dumped_values[k].name, name) == 0)
+            return k;
+    }
+    return -1;
+}
+
+static void dump_lua_values(void)
+{
+    int top = lua_gettop(Luas);
+    int n = 0;
+    int k;
+    bytecode *b = NULL;
+    char **names = NULL;
+    int *modules = NULL;
+    lua_getfield(Luas, LUA_REGISTRYINDEX, DUMPED_MODULES);
+    lua_getfield(Luas, LUA_REGISTRYINDEX, DUMPED_VALUES);
+    lua_pushnil(Luas);
+    while (lua_next(Luas, -2)) {
+        if (lua_type(Luas, -2) == LUA_TSTRING) {
+            const char *name = lua_tostring(Luas, -2);
+            int i;
+            b = xrealloc(b, (unsigned) ((n + 1) * sizeof(bytecode)));
+            names = xrealloc(names, (unsigned) ((n + 1) * sizeof(char *)));
+            modules = xrealloc(modules, (unsigned) ((n + 1) * sizeof(int)));
+            b[n].buf = NULL;
+            b[n].size = 0;
+            b[n].alloc = 0;
+            lua_pushcfunction(Luas, serialize_entry);
+            lua_pushlightuserdata(Luas, &b[n]);
+            lua_pushvalue(Luas, -3);
+            if ((i = lua_pcall(Luas, 2, 0, 0)) != 0) {
+                formatted_warning("dump", "value '%s' is not dumped: %s", name, lua_tostring(Luas, -1));
+                lua_pop(Luas, 1);
+                xfree(b[n].buf);
+            } else {
+                lua_getfield(Luas, -4, name);
+                modules[n] = lua_toboolean(Luas, -1);
+                lua_pop(Luas, 1);
+                names[n] = xstrdup(name);
+                n++;
+            }
+        }
+        lua_pop(Luas, 1);
+    }
+    lua_settop(Luas, top);
+    dump_int(n);
+    for (k = 0; k < n; k++) {
+        int x = (int) strlen(names[k]) + 1;
+        dump_int(x);
+        dump_things(*names[k], x);
+        dump_int(modules[k]);
+        dump_int(b[k].size);
+        do_zdump((char *) b[k].buf, 1, b[k].size, DUMP_FILE);
+        xfree(b[k].buf);
+        xfree(names[k]);
+    }
+    if (n > 0) {
+        print_ln();
+        print_int(n);
+        tprint(" Lua values dumped");
+    }
+    xfree(b);
+    xfree(names);
+    xfree(modules);
+}
+
+static int load_dumped_module(lua_State * L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, DUMPED_VALUES);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_gettable(L, -2);
+    if (lua_isnil(L, -1)) {
+        int k = find_dumped(lua_tostring(L, lua_upvalueindex(1)));
+        if (k >= 0) {
+            lua_pop(L, 1);
+            restore_dumped(L, k);
+            lua_pushvalue(L, lua_upvalueindex(1));
+            lua_gettable(L, -2);
+        }
+    }
+    return 1;
+}
+
+static void undump_lua_values(void)
+{
+    int k, x;
+    int top = lua_gettop(Luas);
+    undump_int(dumped_value_count);
+    if (dumped_value_count < 0) {
+        fatal_error("Corrupt format file");
+    }
+    dumped_values = xmalloc((unsigned) ((dumped_value_count + 1) * sizeof(dumped_value)));
+    for (k = 0; k < dumped_value_count; k++) {
+        dumped_value *d = &dumped_values[k];
+        undump_int(x);
+        if (x <= 0) {
+            fatal_error("Corrupt format file");
+        }
+        d->name = xmalloc((unsigned) x);
+        undump_things(*d->name, x);
+        undump_int(d->module);
+        undump_int(d->size);
+        if (d->size < 0) {
+            fatal_error("Corrupt format file");
+        }
+        d->buf = xmalloc((unsigned) (d->size + 1));
+        do_zundump((char *) d->buf, 1, d->size, DUMP_FILE);
+        if (d->module) {
+            /* |require| gets the module from the format */
+            lua_getglobal(Luas, "package");
+            if (lua_istable(Luas, -1)) {
+                lua_getfield(Luas, -1, "preload");
+                if (lua_istable(Luas, -1)) {
+                    lua_pushstring(Luas, d->name);
+                    lua_pushcclosure(Luas, load_dumped_module, 1);
+                    lua_setfield(Luas, -2, d->name);
+                }
+            }
+            lua_settop(Luas, top);
+        }
+    }
+}
+
 void dump_luac_registers(void)
 {
     int x;
@@ -77,6 +518,7 @@ void dump_luac_registers(void)
             dump_int(x);
         }
     }
+    dump_lua_values();
 }
 
 void undump_luac_registers(void)
@@ -120,6 +562,7 @@ void undump_luac_registers(void)
             luanames[k] = s;
         }
     }
+    undump_lua_values();
 }
 
 static void bytecode_register_shadow_set(lua_State * L, int k)
@@ -353,6 +796,53 @@ static int get_luaname(lua_State * L)
     return 1;
 }
 
+static int set_dumped(lua_State * L)
+{
+    const char *name = luaL_checkstring(L, 1);
+    int k = find_dumped(name);
+    if (k >= 0) {
+        /* forget the one from the format */
+        xfree(dumped_values[k].buf);
+        xfree(dumped_values[k].name);
+        dumped_values[k] = dumped_values[--dumped_value_count];
+    }
+    lua_settop(L, 3);
+    lua_getfield(L, LUA_REGISTRYINDEX, DUMPED_VALUES);
+    lua_pushvalue(L, 2);
+    lua_setfield(L, -2, name);
+    lua_getfield(L, LUA_REGISTRYINDEX, DUMPED_MODULES);
+    if (lua_toboolean(L, 3) && !lua_isnil(L, 2)) {
+        lua_pushboolean(L, 1);
+    } else {
+        lua_pushnil(L);
+    }
+    lua_setfield(L, -2, name);
+    return 0;
+}
+
+static int get_dumped(lua_State * L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, DUMPED_VALUES);
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        const char *name = lua_tostring(L, 1);
+        lua_getfield(L, -1, name);
+        if (lua_isnil(L, -1)) {
+            int k = find_dumped(name);
+            if (k >= 0) {
+                lua_pop(L, 1);
+                restore_dumped(L, k);
+                lua_getfield(L, -1, name);
+            }
+        }
+    } else {
+        /* restore everything and return the whole table */
+        while (dumped_value_count > 0) {
+            restore_dumped(L, dumped_value_count - 1);
+        }
+    }
+    return 1;
+}
+
 static int lua_functions_get_table(lua_State * L) /* hh */
 {
     lua_get_metatablelua(lua_functions);
@@ -385,6 +875,8 @@ static const struct luaL_Reg lualib[] = {
     {"setluaname",  set_luaname},
     {"getbytecode", get_bytecode},
     {"setbytecode", set_bytecode},
+    {"getdumped",   get_dumped},
+    {"setdumped",   set_dumped},
     {"newtable",    new_table},
     {"get_functions_table",lua_functions_get_table},
     {"getstacktop",get_stack_top},
@@ -400,6 +892,10 @@ int luaopen_lua(lua_State * L, char *fname)
     make_table(L, "name",     "tex.name", "getluaname", "setluaname");
     lua_newtable(L);
     lua_setfield(L, LUA_REGISTRYINDEX, "lua.bytecodes.indirect");
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, DUMPED_VALUES);
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, DUMPED_MODULES);
     lua_pushstring(L, LUA_VERSION);
     lua_setfield(L, -2, "version");
     if (fname == NULL) {
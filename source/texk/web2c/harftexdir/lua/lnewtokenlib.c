@@ -265,7 +265,8 @@ inline static int run_put_next(lua_State * L)
                         }
                         t = x;
                     }
-                    lua_pop(L, 1);
+                    /* drop the token and its metatable */
+                    lua_settop(L, m);
                 }
             }
         }
@@ -300,6 +301,103 @@ inline static int run_put_next(lua_State * L)
     return 0;
 }
 
+/*
+    The bulk variants avoid a userdata (and its finalizer) per token: tokens
+    are returned as one flat table with cmd, chr and cs for each token, like
+    the triples made by |make_token_table|. We read at most |n| tokens and
+    stop earlier after the given stop token, which is consumed but not
+    returned.
+
+        local t, n = token.get_next_triples(1000, token.create("relax"))
+        token.put_next_triples(t, n)
+
+    A cs value of zero means a character token.
+*/
+
+static int get_stop_token(lua_State * L, int i)
+{
+    if (lua_type(L, i) == LUA_TNUMBER) {
+        return (int) lua_tointeger(L, i);
+    } else if (lua_type(L, i) == LUA_TUSERDATA) {
+        return token_info(check_istoken(L, i)->token);
+    } else {
+        return -1;
+    }
+}
+
+static int run_get_next_triples(lua_State * L)
+{
+    saved_tex_scanner texstate;
+    int n = lua_type(L, 1) == LUA_TNUMBER ? (int) lua_tointeger(L, 1) : -1;
+    int stop = get_stop_token(L, 2);
+    int i = 0;
+    if (n < 0 && stop < 0) {
+        normal_error("token lib","a count or a stop token expected in get_next_triples");
+    }
+    /* a large count is just a limit, so the table grows when needed */
+    lua_createtable(L, n > 0 ? 3 * (n < 1024 ? n : 1024) : 0, 0);
+    save_tex_scanner(texstate);
+    while (n < 0 || i < n) {
+        get_next();
+        if (stop >= 0 && (cur_cs ? cs_token_flag + cur_cs : token_val(cur_cmd, cur_chr)) == stop) {
+            break;
+        }
+        lua_pushinteger(L, cur_cmd);
+        lua_rawseti(L, -2, 3 * i + 1);
+        lua_pushinteger(L, cur_chr);
+        lua_rawseti(L, -2, 3 * i + 2);
+        lua_pushinteger(L, cur_cs);
+        lua_rawseti(L, -2, 3 * i + 3);
+        i++;
+    }
+    unsave_tex_scanner(texstate);
+    lua_pushinteger(L, i);
+    return 2;
+}
+
+static int run_put_next_triples(lua_State * L)
+{
+    int n, m, i;
+    int cmd, chr, cs;
+    halfword h = null;
+    halfword t = null;
+    halfword x = null;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    m = (int) (lua_rawlen(L, 1) / 3);
+    n = lua_type(L, 2) == LUA_TNUMBER ? (int) lua_tointeger(L, 2) : m;
+    if (n > m) {
+        n = m;
+    }
+    for (i = 0; i < n; i++) {
+        lua_rawgeti(L, 1, 3 * i + 1);
+        lua_rawgeti(L, 1, 3 * i + 2);
+        lua_rawgeti(L, 1, 3 * i + 3);
+        cmd = (int) lua_tointeger(L, -3);
+        chr = (int) lua_tointeger(L, -2);
+        cs = (int) lua_tointeger(L, -1);
+        lua_pop(L, 3);
+        if (cs) {
+            if (cs < 0 || cs > eqtb_top) {
+                normal_error("token lib","invalid control sequence in put_next_triples");
+            }
+        } else if (cmd < 0 || cmd > max_command_cmd || chr < 0 || chr >= STRING_OFFSET) {
+            normal_error("token lib","invalid command or character in put_next_triples");
+        }
+        fast_get_avail(x);
+        token_info(x) = (cs ? cs_token_flag + cs : token_val(cmd, chr));
+        if (h == null) {
+            h = x;
+        } else {
+            token_link(t) = x;
+        }
+        t = x;
+    }
+    if (h != null) {
+        back_list(h);
+    }
+    return 0;
+}
+
 static int run_scan_keyword(lua_State * L)
 {
     saved_tex_scanner texstate;
@@ -1333,6 +1431,8 @@ static const struct luaL_Reg tokenlib[] = {
     { "scan_list", run_scan_list },
     /* writers */
     { "put_next", run_put_next },
+    { "get_next_triples", run_get_next_triples },
+    { "put_next_triples", run_put_next_triples },
     { "expand", run_expand },
     /* getters */
     { "get_command", lua_tokenlib_get_command },
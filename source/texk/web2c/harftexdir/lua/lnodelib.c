@@ -4118,6 +4118,148 @@ static int lua_nodelib_direct_traverse_list(lua_State * L)
     return 3;
 }
 
+/* node.direct.collect */
+/* node.direct.fill_arrays */
+
+/*
+    Walking a list from \LUA\ costs a function call per node, so for code that
+    runs over the same lists many times there are two batched variants. The
+    node types and subtypes to look for can be given as a number or as a table
+    (array) of numbers; |nil| means any.
+*/
+
+#define collect_max_subtypes 64
+
+typedef struct {
+    int any_id;
+    int any_subtype;
+    int subtype_count;
+    char ids[MAX_NODE_TYPE + 1];
+    int subtypes[collect_max_subtypes];
+} collect_filter;
+
+static void collect_get_filter(lua_State * L, int i, int j, collect_filter *f)
+{
+    int k, n;
+    f->any_id = 1;
+    f->any_subtype = 1;
+    f->subtype_count = 0;
+    if (lua_type(L, i) == LUA_TNUMBER) {
+        k = (int) lua_tointeger(L, i);
+        memset(f->ids, 0, sizeof(f->ids));
+        if (k >= 0 && k <= MAX_NODE_TYPE)
+            f->ids[k] = 1;
+        f->any_id = 0;
+    } else if (lua_type(L, i) == LUA_TTABLE) {
+        memset(f->ids, 0, sizeof(f->ids));
+        n = (int) lua_rawlen(L, i);
+        for (k = 1; k <= n; k++) {
+            int t;
+            lua_rawgeti(L, i, k);
+            t = (int) lua_tointeger(L, -1);
+            if (t >= 0 && t <= MAX_NODE_TYPE)
+                f->ids[t] = 1;
+            lua_pop(L, 1);
+        }
+        f->any_id = 0;
+    }
+    if (lua_type(L, j) == LUA_TNUMBER) {
+        f->subtypes[f->subtype_count++] = (int) lua_tointeger(L, j);
+        f->any_subtype = 0;
+    } else if (lua_type(L, j) == LUA_TTABLE) {
+        n = (int) lua_rawlen(L, j);
+        if (n > collect_max_subtypes)
+            luaL_error(L, "at most %d subtypes can be given", collect_max_subtypes);
+        for (k = 1; k <= n; k++) {
+            lua_rawgeti(L, j, k);
+            f->subtypes[f->subtype_count++] = (int) lua_tointeger(L, -1);
+            lua_pop(L, 1);
+        }
+        f->any_subtype = 0;
+    }
+}
+
+static int collect_match(collect_filter *f, halfword p)
+{
+    int k;
+    if (! f->any_id && ! f->ids[type(p)])
+        return 0;
+    if (f->any_subtype)
+        return 1;
+    for (k = 0; k < f->subtype_count; k++) {
+        if (f->subtypes[k] == subtype(p))
+            return 1;
+    }
+    return 0;
+}
+
+/* t, n = node.direct.collect(head [, ids [, subtypes [, tail]]]) */
+
+static int lua_nodelib_direct_collect(lua_State * L)
+{
+    collect_filter f;
+    int n = 0;
+    halfword p = (halfword) lua_tointeger(L, 1);
+    halfword t = (halfword) lua_tointeger(L, 4);
+    collect_get_filter(L, 2, 3, &f);
+    lua_newtable(L);
+    while (p != null && p != t) {
+        if (collect_match(&f, p)) {
+            lua_pushinteger(L, p);
+            lua_rawseti(L, -2, ++n);
+        }
+        p = vlink(p);
+    }
+    lua_pushinteger(L, n);
+    return 2;
+}
+
+/*
+    n = node.direct.fill_arrays(head, nodes, ids, subtypes, chars, fonts [, tail])
+
+    Arrays that are not given (|nil| or |false|) are skipped. Nodes other than
+    glyphs get $-1$ as character and font.
+*/
+
+static int lua_nodelib_direct_fill_arrays(lua_State * L)
+{
+    int n = 0;
+    halfword p = (halfword) lua_tointeger(L, 1);
+    halfword t = (halfword) lua_tointeger(L, 7);
+    int nodes = lua_type(L, 2) == LUA_TTABLE;
+    int ids = lua_type(L, 3) == LUA_TTABLE;
+    int subtypes = lua_type(L, 4) == LUA_TTABLE;
+    int chars = lua_type(L, 5) == LUA_TTABLE;
+    int fonts = lua_type(L, 6) == LUA_TTABLE;
+    while (p != null && p != t) {
+        int glyph = type(p) == glyph_node;
+        n++;
+        if (nodes) {
+            lua_pushinteger(L, p);
+            lua_rawseti(L, 2, n);
+        }
+        if (ids) {
+            lua_pushinteger(L, type(p));
+            lua_rawseti(L, 3, n);
+        }
+        if (subtypes) {
+            lua_pushinteger(L, subtype(p));
+            lua_rawseti(L, 4, n);
+        }
+        if (chars) {
+            lua_pushinteger(L, glyph ? character(p) : -1);
+            lua_rawseti(L, 5, n);
+        }
+        if (fonts) {
+            lua_pushinteger(L, glyph ? font(p) : -1);
+            lua_rawseti(L, 6, n);
+        }
+        p = vlink(p);
+    }
+    lua_pushinteger(L, n);
+    return 1;
+}
+
 /* node.traverse */
 /* node.traverse_id */
 /* node.traverse_char */
@@ -6525,6 +6667,896 @@ static int lua_nodelib_direct_currentattr(lua_State * L)
 }
 
 
+/* node.direct.serialize(head) and node.direct.deserialize(blob) */
+
+/*
+    A node list is written as a sequence of nodes, each with its type, subtype
+    and the raw words of the node, followed by the fields that can't be stored
+    as they are: nested lists, attribute lists, token lists, fonts (by name and
+    size), strings and values in the \LUA\ registry. The pointer fields are
+    zeroed in the raw words. A blob starts with a magic string, a version
+    number and a checksum of the rest. Because raw words are stored as they are
+    a blob is only meant for the same engine on the same platform.
+*/
+
+#define SERIAL_MAGIC   "HTNL"
+#define SERIAL_VERSION 2
+#define SERIAL_HEADER  9
+#define SERIAL_FIELDS  12
+#define SERIAL_WORDS   32
+
+typedef enum {
+    serial_list,   /* a (nested) node list or single node */
+    serial_tokens, /* a token list with reference count */
+    serial_attr,   /* an attribute list */
+    serial_font,   /* a font id */
+    serial_lua,    /* a reference to a value in the registry */
+    serial_string, /* a string pool entry */
+    serial_zero,   /* just cleared */
+} serial_kinds;
+
+typedef struct {
+    int kind;
+    int offset;
+} serial_field;
+
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    size_t len;
+    int *fonts;
+    int font_count;
+} serial_writer;
+
+typedef struct {
+    halfword head; /* the nodes that are complete */
+    halfword node; /* the node that is being read */
+    int done;      /* the fields of that node that are read */
+} serial_level;
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    size_t pos;
+    int *fonts;
+    int font_count;
+    int font_size;
+    serial_level *levels;
+    int depth;
+    int level_size;
+    int *buffer;
+    int buffer_size;
+} serial_reader;
+
+#define serial_add(f,n,k,a) do { \
+    f[n].kind = k; \
+    f[n].offset = (int) ((char *) &(a) - (char *) (varmem + p)); \
+    n++; \
+} while (0)
+
+#define serial_slot(p,f) (*(halfword *) ((char *) (varmem + (p)) + (f).offset))
+
+/*
+    The fields that need special treatment are the same for writing and reading
+    (where only the raw words are present yet), so they are collected in one
+    place. A negative result means that the node can't be serialized.
+*/
+
+static int serial_fields(halfword p, serial_field *f)
+{
+    int n = 0;
+    int t = type(p);
+    if (t > glyph_node)
+        return -1;
+    serial_add(f, n, serial_zero, alink(p));
+    if (nodetype_has_attributes(t))
+        serial_add(f, n, serial_attr, node_attr(p));
+    switch (t) {
+        case hlist_node:
+        case vlist_node:
+        case unset_node:
+            serial_add(f, n, serial_list, list_ptr(p));
+            break;
+        case ins_node:
+            serial_add(f, n, serial_list, ins_ptr(p));
+            serial_add(f, n, serial_list, split_top_ptr(p));
+            break;
+        case mark_node:
+            serial_add(f, n, serial_tokens, mark_ptr(p));
+            break;
+        case adjust_node:
+            serial_add(f, n, serial_list, adjust_ptr(p));
+            break;
+        case disc_node:
+            serial_add(f, n, serial_zero, pre_break(p));
+            serial_add(f, n, serial_zero, post_break(p));
+            serial_add(f, n, serial_zero, no_break(p));
+            serial_add(f, n, serial_zero, tlink_pre_break(p));
+            serial_add(f, n, serial_zero, tlink_post_break(p));
+            serial_add(f, n, serial_zero, tlink_no_break(p));
+            serial_add(f, n, serial_list, vlink_pre_break(p));
+            serial_add(f, n, serial_list, vlink_post_break(p));
+            serial_add(f, n, serial_list, vlink_no_break(p));
+            break;
+        case local_par_node:
+            serial_add(f, n, serial_list, local_box_left(p));
+            serial_add(f, n, serial_list, local_box_right(p));
+            break;
+        case glue_node:
+            serial_add(f, n, serial_list, leader_ptr(p));
+            break;
+        case choice_node:
+            serial_add(f, n, serial_list, display_mlist(p));
+            serial_add(f, n, serial_list, text_mlist(p));
+            serial_add(f, n, serial_list, script_mlist(p));
+            serial_add(f, n, serial_list, script_script_mlist(p));
+            break;
+        case simple_noad:
+            serial_add(f, n, serial_list, nucleus(p));
+            serial_add(f, n, serial_list, subscr(p));
+            serial_add(f, n, serial_list, supscr(p));
+            break;
+        case radical_noad:
+            serial_add(f, n, serial_list, nucleus(p));
+            serial_add(f, n, serial_list, subscr(p));
+            serial_add(f, n, serial_list, supscr(p));
+            serial_add(f, n, serial_list, left_delimiter(p));
+            serial_add(f, n, serial_list, degree(p));
+            break;
+        case accent_noad:
+            serial_add(f, n, serial_list, nucleus(p));
+            serial_add(f, n, serial_list, subscr(p));
+            serial_add(f, n, serial_list, supscr(p));
+            serial_add(f, n, serial_list, top_accent_chr(p));
+            serial_add(f, n, serial_list, bot_accent_chr(p));
+            serial_add(f, n, serial_list, overlay_accent_chr(p));
+            break;
+        case fence_noad:
+            serial_add(f, n, serial_list, delimiter(p));
+            break;
+        case fraction_noad:
+            serial_add(f, n, serial_list, numerator(p));
+            serial_add(f, n, serial_list, denominator(p));
+            serial_add(f, n, serial_list, left_delimiter(p));
+            serial_add(f, n, serial_list, right_delimiter(p));
+            break;
+        case sub_box_node:
+        case sub_mlist_node:
+            serial_add(f, n, serial_list, math_list(p));
+            break;
+        case margin_kern_node:
+            serial_add(f, n, serial_list, margin_char(p));
+            break;
+        case glyph_node:
+            serial_add(f, n, serial_font, font(p));
+            serial_add(f, n, serial_list, lig_ptr(p));
+            break;
+        case whatsit_node:
+            switch (subtype(p)) {
+                case write_node:
+                case special_node:
+                    serial_add(f, n, serial_tokens, write_tokens(p));
+                    break;
+                case close_node:
+                case save_pos_node:
+                case pdf_refobj_node:
+                case pdf_end_link_node:
+                case pdf_end_thread_node:
+                case pdf_save_node:
+                case pdf_restore_node:
+                    break;
+                case late_lua_node:
+                    serial_add(f, n, serial_tokens, late_lua_name(p));
+                    if (late_lua_type(p) == normal)
+                        serial_add(f, n, serial_tokens, late_lua_data(p));
+                    else if (late_lua_type(p) == lua_refid_literal)
+                        serial_add(f, n, serial_lua, late_lua_data(p));
+                    else
+                        return -1;
+                    break;
+                case user_defined_node:
+                    switch (user_node_type(p)) {
+                        case 'a':
+                            serial_add(f, n, serial_attr, user_node_value(p));
+                            break;
+                        case 'd':
+                            break;
+                        case 'l':
+                            serial_add(f, n, serial_lua, user_node_value(p));
+                            break;
+                        case 'n':
+                            serial_add(f, n, serial_list, user_node_value(p));
+                            break;
+                        case 's':
+                            serial_add(f, n, serial_string, user_node_value(p));
+                            break;
+                        case 't':
+                            serial_add(f, n, serial_tokens, user_node_value(p));
+                            break;
+                        default:
+                            return -1;
+                    }
+                    break;
+                case pdf_literal_node:
+                    if (pdf_literal_type(p) == normal)
+                        serial_add(f, n, serial_tokens, pdf_literal_data(p));
+                    else if (pdf_literal_type(p) == lua_refid_literal)
+                        serial_add(f, n, serial_lua, pdf_literal_data(p));
+                    else
+                        return -1;
+                    break;
+                case pdf_colorstack_node:
+                    if (pdf_colorstack_cmd(p) <= colorstack_data)
+                        serial_add(f, n, serial_tokens, pdf_colorstack_data(p));
+                    break;
+                case pdf_setmatrix_node:
+                    serial_add(f, n, serial_tokens, pdf_setmatrix_data(p));
+                    break;
+                case pdf_annot_node:
+                    serial_add(f, n, serial_tokens, pdf_annot_data(p));
+                    break;
+                case pdf_start_link_node:
+                    serial_add(f, n, serial_tokens, pdf_link_attr(p));
+                    serial_add(f, n, serial_list, pdf_link_action(p));
+                    break;
+                case pdf_action_node:
+                    serial_add(f, n, serial_zero, pdf_action_refcount(p));
+                    if (pdf_action_named_id(p) > 0)
+                        serial_add(f, n, serial_tokens, pdf_action_id(p));
+                    serial_add(f, n, serial_tokens, pdf_action_file(p));
+                    serial_add(f, n, serial_tokens, pdf_action_tokens(p));
+                    break;
+                case pdf_dest_node:
+                    if (pdf_dest_named_id(p) > 0)
+                        serial_add(f, n, serial_tokens, pdf_dest_id(p));
+                    break;
+                case pdf_thread_node:
+                case pdf_start_thread_node:
+                    if (pdf_thread_named_id(p) > 0)
+                        serial_add(f, n, serial_tokens, pdf_thread_id(p));
+                    serial_add(f, n, serial_tokens, pdf_thread_attr(p));
+                    break;
+                default:
+                    /* open nodes, fake and internal ones */
+                    return -1;
+            }
+            break;
+    }
+    return n;
+}
+
+static void serial_put_byte(serial_writer *w, int b)
+{
+    if (w->len == w->size) {
+        w->size = 2 * w->size + 256;
+        w->data = xrealloc(w->data, (unsigned) w->size);
+    }
+    w->data[w->len++] = (unsigned char) b;
+}
+
+static void serial_put_unsigned(serial_writer *w, unsigned int v)
+{
+    while (v >= 0x80) {
+        serial_put_byte(w, (int) ((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    serial_put_byte(w, (int) v);
+}
+
+static void serial_put_int(serial_writer *w, int v)
+{
+    serial_put_unsigned(w, ((unsigned int) v << 1) ^ (unsigned int) (v >> 31));
+}
+
+static void serial_put_string(serial_writer *w, const char *s, size_t l)
+{
+    serial_put_unsigned(w, (unsigned int) l);
+    while (l-- > 0)
+        serial_put_byte(w, (unsigned char) *s++);
+}
+
+static void serial_put_tokens(serial_writer *w, halfword p)
+{
+    halfword q;
+    unsigned int n = 0;
+    if (p == null) {
+        serial_put_unsigned(w, 0);
+        return;
+    }
+    for (q = token_link(p); q != null; q = token_link(q))
+        n++;
+    serial_put_unsigned(w, n + 1);
+    for (q = token_link(p); q != null; q = token_link(q)) {
+        int t = token_info(q);
+        if (t >= cs_token_flag) {
+            int cs = t - cs_token_flag;
+            if (((cs >= hash_base && cs < frozen_control_sequence) || cs > eqtb_size) && cs_text(cs) > 0) {
+                size_t l;
+                char *s = makeclstring(cs_text(cs), &l);
+                serial_put_unsigned(w, 1);
+                serial_put_string(w, s, l);
+                free(s);
+            } else {
+                serial_put_unsigned(w, 2);
+                serial_put_int(w, cs);
+            }
+        } else {
+            serial_put_unsigned(w, 0);
+            serial_put_int(w, t);
+        }
+    }
+}
+
+static void serial_put_list(lua_State * L, serial_writer *w, halfword p);
+
+static void serial_put_field(lua_State * L, serial_writer *w, int kind, halfword v)
+{
+    switch (kind) {
+        case serial_list:
+            serial_put_list(L, w, v);
+            break;
+        case serial_tokens:
+            serial_put_tokens(w, v);
+            break;
+        case serial_attr:
+            if (v == null) {
+                serial_put_unsigned(w, 0);
+            } else {
+                halfword a;
+                unsigned int n = 0;
+                for (a = vlink(v); a != null; a = vlink(a))
+                    n++;
+                serial_put_unsigned(w, n + 1);
+                for (a = vlink(v); a != null; a = vlink(a)) {
+                    serial_put_int(w, attribute_id(a));
+                    serial_put_int(w, attribute_value(a));
+                }
+            }
+            break;
+        case serial_font:
+            if (w->fonts[v] > 0) {
+                serial_put_unsigned(w, (unsigned int) w->fonts[v]);
+            } else {
+                w->fonts[v] = ++w->font_count;
+                serial_put_unsigned(w, (unsigned int) w->fonts[v]);
+                serial_put_string(w, font_name(v), strlen(font_name(v)));
+                serial_put_int(w, font_size(v));
+            }
+            break;
+        case serial_lua:
+            if (v == 0) {
+                serial_put_unsigned(w, 0);
+            } else {
+                lua_rawgeti(L, LUA_REGISTRYINDEX, v);
+                if (lua_type(L, -1) == LUA_TSTRING) {
+                    size_t l;
+                    const char *s = lua_tolstring(L, -1, &l);
+                    serial_put_unsigned(w, 1);
+                    serial_put_string(w, s, l);
+                } else if (lua_type(L, -1) == LUA_TNUMBER) {
+                    /* the string representation round trips in \LUA\ 5.3 */
+                    size_t l;
+                    const char *s = lua_tolstring(L, -1, &l);
+                    serial_put_unsigned(w, 2);
+                    serial_put_string(w, s, l);
+                } else if (lua_type(L, -1) == LUA_TBOOLEAN) {
+                    serial_put_unsigned(w, 3);
+                    serial_put_unsigned(w, (unsigned int) lua_toboolean(L, -1));
+                } else {
+                    xfree(w->data);
+                    xfree(w->fonts);
+                    luaL_error(L, "a %s value can't be serialized", luaL_typename(L, -1));
+                }
+                lua_pop(L, 1);
+            }
+            break;
+        case serial_string:
+            {
+                size_t l;
+                char *s = makeclstring(v, &l);
+                serial_put_string(w, s, l);
+                free(s);
+            }
+            break;
+    }
+}
+
+static void serial_put_node(lua_State * L, serial_writer *w, halfword p)
+{
+    serial_field f[SERIAL_FIELDS];
+    memory_word m[SERIAL_WORDS];
+    int n = serial_fields(p, f);
+    int s = get_node_size(type(p), subtype(p));
+    int i;
+    if (n < 0 || s >= SERIAL_WORDS) {
+        xfree(w->data);
+        xfree(w->fonts);
+        luaL_error(L, "a %s node with subtype %d can't be serialized", node_data[type(p)].name, subtype(p));
+    }
+    serial_put_unsigned(w, (unsigned int) type(p) + 1);
+    serial_put_unsigned(w, (unsigned int) subtype(p));
+    memcpy(m, varmem + p, (size_t) s * sizeof(memory_word));
+    for (i = 0; i < n; i++)
+        *(halfword *) ((char *) m + f[i].offset) = null;
+    for (i = 1; i < s; i++) {
+        unsigned int h[2];
+        memcpy(h, m + i, sizeof(h));
+        serial_put_unsigned(w, h[0]);
+        serial_put_unsigned(w, h[1]);
+    }
+    for (i = 0; i < n; i++) {
+        if (f[i].kind != serial_zero)
+            serial_put_field(L, w, f[i].kind, serial_slot(p, f[i]));
+    }
+}
+
+static void serial_put_list(lua_State * L, serial_writer *w, halfword p)
+{
+    while (p != null) {
+        serial_put_node(L, w, p);
+        p = vlink(p);
+    }
+    serial_put_unsigned(w, 0);
+}
+
+static unsigned int serial_checksum(const unsigned char *s, size_t l)
+{
+    unsigned int h = 2166136261U;
+    while (l-- > 0)
+        h = (h ^ *s++) * 16777619U;
+    return h;
+}
+
+static int lua_nodelib_direct_serialize(lua_State * L)
+{
+    serial_writer w;
+    unsigned int c;
+    int i;
+    halfword p = (halfword) lua_tointeger(L, 1);
+    w.size = 1024;
+    w.len = 0;
+    w.data = xmalloc((unsigned) w.size);
+    w.fonts = xcalloc((unsigned) max_font_id() + 1, sizeof(int));
+    w.font_count = 0;
+    for (i = 0; i < SERIAL_HEADER; i++)
+        serial_put_byte(&w, 0);
+    memcpy(w.data, SERIAL_MAGIC, 4);
+    w.data[4] = SERIAL_VERSION;
+    serial_put_list(L, &w, p);
+    c = serial_checksum(w.data + SERIAL_HEADER, w.len - SERIAL_HEADER);
+    for (i = 0; i < 4; i++)
+        w.data[5 + i] = (unsigned char) (c >> (8 * i));
+    lua_pushlstring(L, (const char *) w.data, w.len);
+    xfree(w.data);
+    xfree(w.fonts);
+    return 1;
+}
+
+/*
+    The checksum is verified before anything is built, so a reader only runs
+    out of data when the writer and reader disagree or when the blob was made
+    up. Either way we don't want to leave half a list behind: every nesting
+    level keeps the nodes that are complete and the node whose fields are
+    being read, and |serial_fail| releases all that before it raises the
+    error. This walks the same fields as the reader instead of using
+    |flush_node_list|, which leaves the |split_top_ptr| of an insert alone.
+    Token and attribute lists are read completely before they are built, so
+    they never end up half done.
+*/
+
+static void serial_release_list(lua_State * L, halfword p);
+
+static void serial_release_node(lua_State * L, halfword p, int done)
+{
+    serial_field f[SERIAL_FIELDS];
+    int n = serial_fields(p, f);
+    int i;
+    for (i = 0; i < done && i < n; i++) {
+        halfword v = serial_slot(p, f[i]);
+        switch (f[i].kind) {
+            case serial_list:
+                serial_release_list(L, v);
+                break;
+            case serial_tokens:
+                if (v != null)
+                    delete_token_ref(v);
+                break;
+            case serial_attr:
+                if (v != null)
+                    delete_attribute_ref(v);
+                break;
+            case serial_lua:
+                if (v > 0)
+                    luaL_unref(L, LUA_REGISTRYINDEX, v);
+                break;
+        }
+    }
+    free_node(p, get_node_size(type(p), subtype(p)));
+}
+
+static void serial_release_list(lua_State * L, halfword p)
+{
+    while (p != null) {
+        halfword q = vlink(p);
+        serial_release_node(L, p, SERIAL_FIELDS);
+        p = q;
+    }
+}
+
+static void serial_fail(lua_State * L, serial_reader *r, const char *fmt, ...)
+{
+    va_list args;
+    int i;
+    for (i = 0; i < r->depth; i++) {
+        serial_release_list(L, r->levels[i].head);
+        if (r->levels[i].node != null)
+            serial_release_node(L, r->levels[i].node, r->levels[i].done);
+    }
+    xfree(r->levels);
+    xfree(r->fonts);
+    xfree(r->buffer);
+    luaL_where(L, 1);
+    va_start(args, fmt);
+    lua_pushvfstring(L, fmt, args);
+    va_end(args);
+    lua_concat(L, 2);
+    lua_error(L);
+}
+
+static unsigned int serial_get_unsigned(lua_State * L, serial_reader *r)
+{
+    unsigned int v = 0;
+    int shift = 0;
+    while (1) {
+        int b;
+        if (r->pos >= r->len || shift > 28)
+            serial_fail(L, r, "the serialized node list is truncated");
+        b = r->data[r->pos++];
+        v |= (unsigned int) (b & 0x7F) << shift;
+        if (b < 0x80)
+            return v;
+        shift += 7;
+    }
+}
+
+static int serial_get_int(lua_State * L, serial_reader *r)
+{
+    unsigned int v = serial_get_unsigned(L, r);
+    return (int) ((v >> 1) ^ (~(v & 1) + 1));
+}
+
+static const char *serial_get_string(lua_State * L, serial_reader *r, size_t *l)
+{
+    const char *s;
+    *l = (size_t) serial_get_unsigned(L, r);
+    if (*l > r->len - r->pos)
+        serial_fail(L, r, "the serialized node list is truncated");
+    s = (const char *) r->data + r->pos;
+    r->pos += *l;
+    return s;
+}
+
+static void serial_buffer(serial_reader *r, int n)
+{
+    if (n > r->buffer_size) {
+        r->buffer_size = 2 * n;
+        r->buffer = xrealloc(r->buffer, (unsigned) (r->buffer_size * (int) sizeof(int)));
+    }
+}
+
+/*
+    A control sequence that is stored by number has to be a location in |eqtb|
+    and other tokens have to carry a command code that \TEX\ knows about.
+*/
+
+static halfword serial_get_tokens(lua_State * L, serial_reader *r)
+{
+    halfword h, q;
+    int i;
+    unsigned int n = serial_get_unsigned(L, r);
+    if (n == 0)
+        return null;
+    if (--n > r->len - r->pos)
+        serial_fail(L, r, "the serialized node list is truncated");
+    serial_buffer(r, (int) n);
+    for (i = 0; i < (int) n; i++) {
+        int t;
+        switch (serial_get_unsigned(L, r)) {
+            case 1:
+                {
+                    size_t l;
+                    const char *s = serial_get_string(L, r, &l);
+                    int nncs = no_new_control_sequence;
+                    no_new_control_sequence = false;
+                    t = cs_token_flag + string_lookup(s, l);
+                    no_new_control_sequence = nncs;
+                }
+                break;
+            case 2:
+                t = serial_get_int(L, r);
+                if (t < 0 || t > eqtb_top)
+                    serial_fail(L, r, "the serialized node list has a bad control sequence %d", t);
+                t += cs_token_flag;
+                break;
+            default:
+                t = serial_get_int(L, r);
+                if (t < 0 || token_cmd(t) > max_command_cmd)
+                    serial_fail(L, r, "the serialized node list has a bad token %d", t);
+                break;
+        }
+        r->buffer[i] = t;
+    }
+    h = get_avail();
+    token_ref_count(h) = 0;
+    q = h;
+    for (i = 0; i < (int) n; i++) {
+        token_link(q) = get_avail();
+        q = token_link(q);
+        token_info(q) = r->buffer[i];
+        token_link(q) = null;
+    }
+    return h;
+}
+
+static halfword serial_get_attributes(lua_State * L, serial_reader *r)
+{
+    halfword h, q;
+    int i;
+    unsigned int n = serial_get_unsigned(L, r);
+    if (n == 0)
+        return null;
+    if (--n > (r->len - r->pos) / 2)
+        serial_fail(L, r, "the serialized node list is truncated");
+    serial_buffer(r, 2 * (int) n);
+    for (i = 0; i < 2 * (int) n; i++)
+        r->buffer[i] = serial_get_int(L, r);
+    h = get_node(attribute_node_size);
+    type(h) = attribute_list_node;
+    attr_list_ref(h) = 0;
+    attr_list_slot(h) = -1;
+    q = h;
+    for (i = 0; i < (int) n; i++) {
+        vlink(q) = get_node(attribute_node_size);
+        q = vlink(q);
+        type(q) = attribute_node;
+        subtype(q) = 0;
+        attribute_id(q) = r->buffer[2 * i];
+        attribute_value(q) = r->buffer[2 * i + 1];
+    }
+    h = intern_attribute_list(h);
+    attr_list_ref(h)++;
+    return h;
+}
+
+static int serial_get_font(lua_State * L, serial_reader *r)
+{
+    int k = (int) serial_get_unsigned(L, r);
+    if (k == r->font_count + 1) {
+        size_t l;
+        const char *s = serial_get_string(L, r, &l);
+        scaled size = serial_get_int(L, r);
+        char *name = xmalloc((unsigned) (l + 1));
+        int f;
+        int m = max_font_id();
+        memcpy(name, s, l);
+        name[l] = '\0';
+        for (f = 1; f <= m; f++) {
+            if (is_valid_font(f) && font_size(f) == size && strcmp(font_name(f), name) == 0)
+                break;
+        }
+        if (f > m) {
+            f = find_font_id(name, size);
+            if (f == 0)
+                formatted_warning("node lib", "font '%s' at size %d used in a serialized list can't be loaded", name, size);
+        }
+        free(name);
+        if (r->font_count == r->font_size) {
+            r->font_size = 2 * r->font_size + 8;
+            r->fonts = xrealloc(r->fonts, (unsigned) (r->font_size * (int) sizeof(int)));
+        }
+        r->fonts[r->font_count++] = f;
+    } else if (k < 1 || k > r->font_count) {
+        serial_fail(L, r, "the serialized node list has a bad font reference");
+    }
+    return r->fonts[k - 1];
+}
+
+static halfword serial_get_list(lua_State * L, serial_reader *r);
+
+static halfword serial_get_field(lua_State * L, serial_reader *r, int kind)
+{
+    switch (kind) {
+        case serial_list:
+            return serial_get_list(L, r);
+        case serial_tokens:
+            return serial_get_tokens(L, r);
+        case serial_attr:
+            return serial_get_attributes(L, r);
+        case serial_font:
+            return serial_get_font(L, r);
+        case serial_lua:
+            {
+                size_t l;
+                const char *s;
+                switch (serial_get_unsigned(L, r)) {
+                    case 0:
+                        return 0;
+                    case 1:
+                        s = serial_get_string(L, r, &l);
+                        lua_pushlstring(L, s, l);
+                        break;
+                    case 2:
+                        s = serial_get_string(L, r, &l);
+                        lua_pushlstring(L, s, l);
+                        if (lua_stringtonumber(L, lua_tostring(L, -1)) != 0)
+                            lua_remove(L, -2);
+                        break;
+                    default:
+                        lua_pushboolean(L, (int) serial_get_unsigned(L, r));
+                        break;
+                }
+                return luaL_ref(L, LUA_REGISTRYINDEX);
+            }
+        case serial_string:
+            {
+                size_t l;
+                const char *s = serial_get_string(L, r, &l);
+                return maketexlstring(s, l);
+            }
+    }
+    return null;
+}
+
+/*
+    Only subtypes that the engine itself can produce are accepted. Glyphs keep
+    flags in their subtype and the subtype of an insert is its class, so these
+    can have any value.
+*/
+
+static boolean serial_known_subtype(int t, int st)
+{
+    subtype_info *s;
+    if (st > max_quarterword)
+        return false;
+    switch (t) {
+        case whatsit_node:
+            return known_whatsit_type(st) && whatsit_node_data[st].id == st;
+        case glue_node:
+            if (st >= cond_math_glue && st <= g_leaders)
+                return true;
+            break;
+        case glyph_node:
+            return true;
+    }
+    s = node_data[t].subtypes;
+    if (s == NULL)
+        return true;
+    for (; s->id >= 0; s++) {
+        if (s->id == st)
+            return true;
+    }
+    return false;
+}
+
+static halfword serial_get_node(lua_State * L, serial_reader *r, int t, int level)
+{
+    serial_field f[SERIAL_FIELDS];
+    memory_word m[SERIAL_WORDS];
+    halfword p;
+    int st = (int) serial_get_unsigned(L, r);
+    int n, s, i;
+    if (t > glyph_node || ! serial_known_subtype(t, st))
+        serial_fail(L, r, "the serialized node list has a bad node type %d with subtype %d", t, st);
+    s = get_node_size(t, st);
+    if (s < 1 || s >= SERIAL_WORDS)
+        serial_fail(L, r, "the serialized node list has a bad node type %d with subtype %d", t, st);
+    for (i = 1; i < s; i++) {
+        unsigned int h[2];
+        h[0] = serial_get_unsigned(L, r);
+        h[1] = serial_get_unsigned(L, r);
+        memcpy(m + i, h, sizeof(h));
+    }
+    p = get_node(s);
+    type(p) = (quarterword) t;
+    subtype(p) = (quarterword) st;
+    memcpy(varmem + p + 1, m + 1, (size_t) (s - 1) * sizeof(memory_word));
+    r->levels[level].node = p;
+    r->levels[level].done = 0;
+    n = serial_fields(p, f);
+    if (n < 0)
+        serial_fail(L, r, "the serialized node list has a bad %s node", node_data[t].name);
+    for (i = 0; i < n; i++)
+        serial_slot(p, f[i]) = null;
+    for (i = 0; i < n; i++) {
+        if (f[i].kind != serial_zero) {
+            /* the node memory can move while we read, so no pointers here */
+            halfword v = serial_get_field(L, r, f[i].kind);
+            serial_slot(p, f[i]) = v;
+        }
+        r->levels[level].done++;
+    }
+    if (t == disc_node) {
+        pre_break(p) = pre_break_head(p);
+        post_break(p) = post_break_head(p);
+        no_break(p) = no_break_head(p);
+        if (vlink_pre_break(p) != null) {
+            alink(vlink_pre_break(p)) = pre_break(p);
+            tlink_pre_break(p) = tail_of_list(vlink_pre_break(p));
+        }
+        if (vlink_post_break(p) != null) {
+            alink(vlink_post_break(p)) = post_break(p);
+            tlink_post_break(p) = tail_of_list(vlink_post_break(p));
+        }
+        if (vlink_no_break(p) != null) {
+            alink(vlink_no_break(p)) = no_break(p);
+            tlink_no_break(p) = tail_of_list(vlink_no_break(p));
+        }
+    }
+    r->levels[level].node = null;
+    return p;
+}
+
+static halfword serial_get_list(lua_State * L, serial_reader *r)
+{
+    halfword h, q = null;
+    int level = r->depth;
+    int t;
+    if (r->depth == r->level_size) {
+        r->level_size = 2 * r->level_size + 8;
+        r->levels = xrealloc(r->levels, (unsigned) (r->level_size * (int) sizeof(serial_level)));
+    }
+    r->levels[level].head = null;
+    r->levels[level].node = null;
+    r->depth++;
+    while ((t = (int) serial_get_unsigned(L, r)) > 0) {
+        halfword p = serial_get_node(L, r, t - 1, level);
+        if (q == null) {
+            r->levels[level].head = p;
+        } else {
+            couple_nodes(q, p);
+        }
+        q = p;
+    }
+    h = r->levels[level].head;
+    r->depth--;
+    return h;
+}
+
+static int lua_nodelib_direct_deserialize(lua_State * L)
+{
+    serial_reader r;
+    unsigned int c = 0;
+    int i;
+    halfword h;
+    r.data = (const unsigned char *) luaL_checklstring(L, 1, &r.len);
+    r.pos = SERIAL_HEADER;
+    r.fonts = NULL;
+    r.font_count = 0;
+    r.font_size = 0;
+    r.levels = NULL;
+    r.depth = 0;
+    r.level_size = 0;
+    r.buffer = NULL;
+    r.buffer_size = 0;
+    if (r.len < SERIAL_HEADER || memcmp(r.data, SERIAL_MAGIC, 4) != 0)
+        serial_fail(L, &r, "the string is not a serialized node list");
+    if (r.data[4] != SERIAL_VERSION)
+        serial_fail(L, &r, "the serialized node list has version %d instead of %d", r.data[4], SERIAL_VERSION);
+    for (i = 0; i < 4; i++)
+        c |= (unsigned int) r.data[5 + i] << (8 * i);
+    if (c != serial_checksum(r.data + SERIAL_HEADER, r.len - SERIAL_HEADER))
+        serial_fail(L, &r, "the serialized node list is damaged");
+    h = serial_get_list(L, &r);
+    xfree(r.levels);
+    xfree(r.fonts);
+    xfree(r.buffer);
+    if (h == null)
+        lua_pushnil(L);
+    else
+        lua_pushinteger(L, h);
+    return 1;
+}
+
 /* node.direct.todirect */
 
 static int lua_nodelib_direct_todirect(lua_State * L)
@@ -8846,14 +9878,17 @@ static void lua_new_properties_table(lua_State * L)
 static const struct luaL_Reg direct_nodelib_f[] = {
     {"copy", lua_nodelib_direct_copy},
     {"copy_list", lua_nodelib_direct_copy_list},
+    {"collect", lua_nodelib_direct_collect},
     {"count", lua_nodelib_direct_count},
     {"current_attr", lua_nodelib_direct_currentattr},
+    {"deserialize", lua_nodelib_direct_deserialize},
     {"dimensions", lua_nodelib_direct_dimensions},
     {"rangedimensions", lua_nodelib_direct_rangedimensions},
  /* {"do_ligature_n", lua_nodelib_direct_do_ligature_n}, */
     {"end_of_math", lua_nodelib_direct_end_of_math},
  /* {"family_font", lua_nodelib_mfont}, */ /* no node argument */
  /* {"fields", lua_nodelib_fields}, */ /* no node argument */
+    {"fill_arrays", lua_nodelib_direct_fill_arrays},
     {"first_glyph", lua_nodelib_direct_first_glyph},
     {"flush_list", lua_nodelib_direct_flush_list},
     {"flush_node", lua_nodelib_direct_flush_node},
@@ -8915,6 +9950,7 @@ static const struct luaL_Reg direct_nodelib_f[] = {
     {"protect_glyph", lua_nodelib_direct_protect_glyph},
     {"protrusion_skippable", lua_nodelib_direct_cp_skipable},
     {"remove", lua_nodelib_direct_remove},
+    {"serialize", lua_nodelib_direct_serialize},
     {"set_attribute", lua_nodelib_direct_set_attribute},
     {"setbox", lua_nodelib_direct_setbox},
     {"setfield", lua_nodelib_direct_setfield},
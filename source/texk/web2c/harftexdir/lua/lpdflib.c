@@ -814,6 +814,12 @@ static int getpdfomitcharset(lua_State * L)
     return 1 ;
 }
 
+static int getpdffontworkers(lua_State * L)
+{
+    lua_pushinteger(L, (pdf_font_workers));
+    return 1 ;
+}
+
 static int setpdfgentounicode(lua_State * L)
 {
     if (lua_type(L, 1) == LUA_TNUMBER) {
@@ -838,6 +844,59 @@ static int setpdfomitcharset(lua_State * L)
     return 0 ;
 }
 
+static int getpdffontcache(lua_State * L)
+{
+    const char *s = get_font_cache_path();
+    if (s != NULL) {
+        lua_pushstring(L, s);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1 ;
+}
+
+static int setpdffontcache(lua_State * L)
+{
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        set_font_cache_path(lua_tostring(L, 1));
+    } else {
+        set_font_cache_path(NULL);
+    }
+    return 0 ;
+}
+
+static int getpdfimagecache(lua_State * L)
+{
+    const char *s = get_image_cache_path();
+    if (s != NULL) {
+        lua_pushstring(L, s);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1 ;
+}
+
+static int setpdfimagecache(lua_State * L)
+{
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        set_image_cache_path(lua_tostring(L, 1));
+    } else {
+        set_image_cache_path(NULL);
+    }
+    return 0 ;
+}
+
+static int setpdffontworkers(lua_State * L)
+{
+    if (lua_type(L, 1) == LUA_TNUMBER) {
+        int c = (int) lua_tointeger(L, 1);
+        if (c<0)
+            c = 0 ;
+        set_pdf_font_workers(c);
+    }
+    return 0 ;
+}
+
 /* for tracing purposes when no pages are flushed */
 
 static int setforcefile(lua_State * L)
@@ -1350,11 +1409,17 @@ static const struct luaL_Reg pdflib[] = {
     { "getgentounicode", getpdfgentounicode },
     { "getomitcidset", getpdfomitcidset },
     { "getomitcharset", getpdfomitcharset },
+    { "getfontworkers", getpdffontworkers },
+    { "getfontcache", getpdffontcache },
+    { "getimagecache", getpdfimagecache },
     { "setinclusionerrorlevel", setpdfinclusionerrorlevel },
     { "setignoreunknownimages", setpdfignoreunknownimages },
     { "setgentounicode", setpdfgentounicode },
     { "setomitcidset", setpdfomitcidset },
     { "setomitcharset", setpdfomitcharset },
+    { "setfontworkers", setpdffontworkers },
+    { "setfontcache", setpdffontcache },
+    { "setimagecache", setpdfimagecache },
     { "setforcefile", setforcefile },
     { "mapfile", l_mapfile },
     { "mapline", l_mapline },
@@ -31,6 +31,7 @@ typedef struct statistic {
 typedef const char *(*charfunc) (void);
 typedef lua_Number(*numfunc) (void);
 typedef int (*intfunc) (void);
+typedef void (*tablefunc) (lua_State *);
 
 static const char *getbanner(void)
 {
@@ -369,6 +370,9 @@ static struct statistic stats[] = {
     {"input_ptr", 'g', &input_ptr},
     {"obj_ptr", 'N', &get_obj_ptr},
     {"obj_tab_size", 'N', &get_obj_tab_size},
+    {"obj_map_size", 'g', &obj_map_size},
+    {"obj_map_entries", 'g', &obj_map_entries},
+    {"obj_map_lookups", 'g', &obj_map_lookups},
     {"pdf_os_cntr", 'N', &get_pdf_os_cntr},
     {"pdf_os_objidx", 'N', &get_pdf_os_objidx},
     {"pdf_dest_names_ptr", 'N', &get_dest_names_ptr},
@@ -379,6 +383,7 @@ static struct statistic stats[] = {
     {"luabytecodes", 'g', &luabytecode_max},
     {"luabytecode_bytes", 'g', &luabytecode_bytes},
     {"luastate_bytes", 'g', &luastate_bytes},
+    {"luapool", 'T', (void *) &lua_pool_status},
 
     {"callbacks", 'g', &callback_count},
     {"indirect_callbacks", 'g', &saved_callback_count}, /* these are file io callbacks */
@@ -412,6 +417,7 @@ static int do_getstat(lua_State * L, int i)
     charfunc f;
     intfunc g;
     numfunc n;
+    tablefunc tf;
     int str;
     t = stats[i].type;
     switch (t) {
@@ -454,6 +460,10 @@ static int do_getstat(lua_State * L, int i)
     case 'b':
         lua_pushboolean(L, *(int *) (stats[i].value));
         break;
+    case 'T':
+        tf = stats[i].value;
+        tf(L);
+        break;
     default:
         lua_pushnil(L);
     }
@@ -512,8 +522,43 @@ static int setexitcode(lua_State * L) {
     return 0;
 }
 
+/*
+    With a boolean argument macro profiling is switched on or off, a second
+    boolean enables timing, and the previous state is returned. Without
+    arguments we return a table with the accumulated data per macro.
+*/
+
+static int macroprofile(lua_State * L)
+{
+    int i;
+    if (lua_type(L, 1) == LUA_TBOOLEAN) {
+        lua_pushboolean(L, macro_profiling);
+        macro_profile_enable(lua_toboolean(L, 1), lua_toboolean(L, 2));
+        return 1;
+    }
+    luaL_checkstack(L, 3, "out of stack space");
+    lua_createtable(L, 0, macro_profile_used);
+    for (i = 1; i < macro_profile_used; i++) {
+        macro_profile_entry *e = &macro_profile_data[i];
+        char *s = macro_profile_name(e->cs);
+        lua_createtable(L, 0, 4);
+        lua_pushinteger(L, e->count);
+        lua_setfield(L, -2, "count");
+        lua_pushinteger(L, e->inclusive);
+        lua_setfield(L, -2, "inclusive");
+        lua_pushinteger(L, e->exclusive);
+        lua_setfield(L, -2, "exclusive");
+        lua_pushnumber(L, e->time);
+        lua_setfield(L, -2, "time");
+        lua_setfield(L, -2, s);
+        free(s);
+    }
+    return 1;
+}
+
 static const struct luaL_Reg statslib[] = {
     {"list", statslist},
+    {"macro_profile", macroprofile},
     {"resetmessages", resetmessages},
     {"setexitcode", setexitcode},
     {NULL, NULL}                /* sentinel */
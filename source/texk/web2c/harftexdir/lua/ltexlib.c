@@ -31,8 +31,9 @@ extern int norm_rand(void );
 extern void init_randoms(int );
 
 typedef struct {
-    char *text;
+    const char *text;
     unsigned int tsize;
+    int ref;
     void *next;
     boolean partial;
     int cattable;
@@ -56,19 +57,68 @@ static int spindle_size  = 0;
 static spindle *spindles = NULL;
 static int spindle_index = 0;
 
+/*
+    Large strings are not copied: we keep a reference to the \LUA\ string so
+    that it stays alive and copy it into the buffer straight from \LUA's
+    memory when the line is read. For short strings a copy is cheaper than
+    the reference.
+*/
+
+#define PINNED_STRING_SIZE 256
+
+static void free_rope_text(rope *t)
+{
+    if (t->ref != LUA_NOREF) {
+        luaL_unref(Luas, LUA_REGISTRYINDEX, t->ref);
+        t->ref = LUA_NOREF;
+    } else if (t->text != NULL) {
+        free((char *) t->text);
+    }
+    t->text = NULL;
+}
+
+static void luac_store_rope(const char *st, size_t tsize, int ref, halfword tok, halfword nod, int partial, int cattable)
+{
+    rope *rn = (rope *) xmalloc(sizeof(rope));
+    luacstrings++;
+    rn->text = st;
+    rn->tsize = (unsigned) tsize;
+    rn->ref = ref;
+    rn->tok = tok;
+    rn->nod = nod;
+    rn->next = NULL;
+    rn->partial = partial;
+    rn->cattable = cattable;
+    /* add */
+    if (write_spindle.head == NULL) {
+        write_spindle.head = rn;
+    } else {
+        write_spindle.tail->next = rn;
+    }
+    write_spindle.tail = rn;
+    write_spindle.complete = 0;
+}
+
 static int luac_store(lua_State * L, int i, int partial, int cattable)
 {
-    char *st = NULL;
+    const char *st = NULL;
     size_t tsize = 0;
-    rope *rn = NULL;
+    int ref = LUA_NOREF;
     halfword tok = null;
     halfword nod = null;
     int t = lua_type(L, i);
     if (t == LUA_TNUMBER || t == LUA_TSTRING) {
         const char *sttemp;
         sttemp = lua_tolstring(L, i, &tsize);
-        st = xmalloc((unsigned) (tsize + 1));
-        memcpy(st, sttemp, (tsize + 1));
+        if (tsize >= PINNED_STRING_SIZE) {
+            lua_pushvalue(L, i);
+            ref = luaL_ref(L, LUA_REGISTRYINDEX);
+            st = sttemp;
+        } else {
+            char *copy = xmalloc((unsigned) (tsize + 1));
+            memcpy(copy, sttemp, (tsize + 1));
+            st = copy;
+        }
     } else if (t == LUA_TUSERDATA) {
         void *p ;
         p = lua_touserdata(L, i);
@@ -95,27 +145,53 @@ static int luac_store(lua_State * L, int i, int partial, int cattable)
     } else {
         return 0;
     }
-    /* common */
-    luacstrings++;
-    rn = (rope *) xmalloc(sizeof(rope));
-    rn->text = st;
-    rn->tsize = (unsigned) tsize;
-    rn->tok = tok;
-    rn->nod = nod;
-    rn->next = NULL;
-    rn->partial = partial;
-    rn->cattable = cattable;
-    /* add */
-    if (write_spindle.head == NULL) {
-        write_spindle.head = rn;
-    } else {
-        write_spindle.tail->next = rn;
-    }
-    write_spindle.tail = rn;
-    write_spindle.complete = 0;
+    luac_store_rope(st, tsize, ref, tok, nod, partial, cattable);
     return 1;
 }
 
+/*
+    The bulk variant glues all strings (and numbers) of a table into one
+    partial line, so we need one allocation and one rope for the lot. It stops
+    at the first element that is not a string or number.
+*/
+
+static void luac_store_bulk(lua_State * L, int i, int cattable)
+{
+    size_t tsize = 0;
+    size_t l;
+    char *st, *p;
+    int j, n;
+    for (j = 1;; j++) {
+        int t;
+        lua_rawgeti(L, i, j);
+        t = lua_type(L, -1);
+        if (t == LUA_TSTRING || t == LUA_TNUMBER) {
+            lua_tolstring(L, -1, &l);
+            tsize += l;
+            lua_pop(L, 1);
+        } else {
+            lua_pop(L, 1);
+            break;
+        }
+    }
+    n = j - 1;
+    if (n == 0) {
+        return;
+    }
+    st = xmalloc((unsigned) (tsize + 1));
+    p = st;
+    for (j = 1; j <= n; j++) {
+        const char *s;
+        lua_rawgeti(L, i, j);
+        s = lua_tolstring(L, -1, &l);
+        memcpy(p, s, l);
+        p += l;
+        lua_pop(L, 1);
+    }
+    *p = '\0';
+    luac_store_rope(st, tsize, LUA_NOREF, null, null, PARTIAL_LINE, cattable);
+}
+
 static int do_luacprint(lua_State * L, int partial, int deftable)
 {
     int cattable = deftable;
@@ -271,6 +347,26 @@ static int luacsprint(lua_State * L)
     return do_luacprint(L, PARTIAL_LINE, DEFAULT_CAT_TABLE);
 }
 
+/* lua.bulksprint */
+
+static int luacbulksprint(lua_State * L)
+{
+    int cattable = DEFAULT_CAT_TABLE;
+    int i = 1;
+    if (lua_type(L, 1) == LUA_TNUMBER && lua_gettop(L) > 1) {
+        cattable = lua_tointeger(L, 1);
+        i = 2;
+        if (cattable != -1 && cattable != -2 && !valid_catcode_table(cattable)) {
+            cattable = DEFAULT_CAT_TABLE;
+        }
+    }
+    if (lua_type(L, i) != LUA_TTABLE) {
+        luaL_error(L, "no table to print");
+    }
+    luac_store_bulk(L, i, cattable);
+    return 0;
+}
+
 /* lua.cprint */
 
 static int luaccprint(lua_State * L)
@@ -373,18 +469,16 @@ int luacstring_input(halfword *n)
     }
     if (t->text != NULL) {
         /* put that thing in the buffer */
-        char *st = t->text;
         int ret = first;
         last = first;
         check_buffer_overflow(last + (int) t->tsize);
-        while (t->tsize-- > 0)
-            buffer[last++] = (packed_ASCII_code) * st++;
+        memcpy(buffer + last, t->text, t->tsize);
+        last += (int) t->tsize;
         if (!t->partial) {
             while (last - 1 > ret && buffer[last - 1] == ' ')
                 last--;
         }
-        free(t->text);
-        t->text = NULL;
+        free_rope_text(t);
     } else if (t->tok > 0) {
         *n = t->tok;
         ret = 2;
@@ -425,8 +519,7 @@ void luacstring_close(int n)
     (void) n; /* for -W */
     next = read_spindle.head;
     while (next != NULL) {
-        if (next->text != NULL)
-            free(next->text);
+        free_rope_text(next);
         t = next;
         next = next->next;
         if (t==read_spindle.tail) {
@@ -3083,8 +3176,9 @@ static int tex_reset_paragraph(lua_State * L)
 static int tex_shipout(lua_State * L)
 {
     int boxnum = get_box_id(L, 1, true);
-    ship_out(static_pdf, box(boxnum), SHIPPING_PAGE);
-    box(boxnum) = null;
+    halfword p = box(boxnum);
+    change_box(boxnum, null);
+    ship_out(static_pdf, p, SHIPPING_PAGE);
     return 0;
 }
 
@@ -3249,7 +3343,7 @@ static int tex_save_box_resource(lua_State * L)
     if (lua_type(L,1) == LUA_TNUMBER) {
         halfword boxnumber = lua_tointeger(L,1);
         boxdata = box(boxnumber);
-        box(boxnumber) = null;
+        change_box(boxnumber, null);
     } else {
         boxdata = nodelist_from_lua(L,1);
         if (type(boxdata) != hlist_node && type(boxdata) != vlist_node) {
@@ -3531,6 +3625,77 @@ static int runtoks(lua_State * L)
     return 0;
 }
 
+/*
+    A checkpoint records all assignments made after it, so that they can be
+    undone with tex.rollback or accepted with tex.commit. Both default to the
+    most recent checkpoint.
+*/
+
+static int tex_checkpoint(lua_State * L)
+{
+    lua_pushinteger(L, new_checkpoint());
+    return 1;
+}
+
+static int tex_commit(lua_State * L)
+{
+    int n = (int) luaL_optinteger(L, 1, checkpoint_ptr);
+    if (! commit_checkpoint(n)) {
+        luaL_error(L, "there is no checkpoint %d to commit", n);
+    }
+    return 0;
+}
+
+static int tex_rollback(lua_State * L)
+{
+    int n = (int) luaL_optinteger(L, 1, checkpoint_ptr);
+    switch (rollback_checkpoint(n)) {
+        case checkpoint_unknown:
+            luaL_error(L, "there is no checkpoint %d to roll back", n);
+            break;
+        case checkpoint_wrong_group:
+            luaL_error(L, "checkpoint %d can only be rolled back in the group where it was made", n);
+            break;
+        case checkpoint_wrong_list:
+            luaL_error(L, "checkpoint %d can only be rolled back in the list where it was made", n);
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+/*
+    The math cache reuses the result of converting a formula that is identical
+    to one seen before. Without arguments we return the statistics, otherwise
+    the cache is turned on or off (which also empties it). The optional second
+    argument is an attribute that, when set, keeps a formula out of the cache.
+*/
+
+static int tex_mathcache(lua_State * L)
+{
+    if (lua_gettop(L) == 0) {
+        lua_createtable(L, 0, 6);
+        lua_pushboolean(L, math_cache_enabled);
+        lua_setfield(L, -2, "enabled");
+        lua_pushinteger(L, math_cache_attribute);
+        lua_setfield(L, -2, "attribute");
+        lua_pushinteger(L, math_cache_hits);
+        lua_setfield(L, -2, "hits");
+        lua_pushinteger(L, math_cache_misses);
+        lua_setfield(L, -2, "misses");
+        lua_pushinteger(L, math_cache_skipped);
+        lua_setfield(L, -2, "skipped");
+        lua_pushinteger(L, math_cache_entries);
+        lua_setfield(L, -2, "entries");
+    } else {
+        int previous = math_cache_enabled;
+        math_cache_enable(lua_toboolean(L, 1), (int) luaL_optinteger(L, 2, -1));
+        lua_pushboolean(L, previous);
+    }
+    return 1;
+}
+
 /* till here */
 
 void init_tex_table(lua_State * L)
@@ -3551,6 +3716,7 @@ static const struct luaL_Reg texlib[] = {
     { "write", luacwrite },
     { "print", luacprint },
     { "sprint", luacsprint },
+    { "bulksprint", luacbulksprint },
     { "tprint", luactprint },
     { "cprint", luaccprint },
     /*
@@ -3654,6 +3820,10 @@ static const struct luaL_Reg texlib[] = {
     { "get_synctex_line", lua_get_synctex_line },
     /* test */
     { "runtoks", runtoks },
+    { "checkpoint", tex_checkpoint },
+    { "commit", tex_commit },
+    { "rollback", tex_rollback },
+    { "mathcache", tex_mathcache },
     { "forcehmode", forcehmode },
     /* sentinel */
     { NULL, NULL }
@@ -67,6 +67,8 @@ const_string LUATEX_IHELP[] = {
     "",
     "  The following regular options are understood: ",
     "",
+    "   --buffered-input              read input files into memory as a whole instead of line by line",
+    "   --client=SOCKET               hand the job to the server at SOCKET (must be the first option)",
     "   --credits                     display credits and exit",
     "   --debug-format                enable format debugging",
     "   --draftmode                   switch on draft mode (generates no output PDF)",
@@ -80,7 +82,9 @@ const_string LUATEX_IHELP[] = {
     "   --jobname=STRING              set the job name to STRING",
     "   --kpathsea-debug=NUMBER       set path searching debugging flags according to the bits of NUMBER",
     "   --lua=FILE                    load and execute a lua initialization script",
+    "   --lua-pool                    allocate small lua objects from pools (faster for allocation heavy code)",
     "   --[no-]mktex=FMT              disable/enable mktexFMT generation (FMT=tex/tfm)",
+    "   --native-format               dump an uncompressed format for this machine only (loads faster)",
     "   --nosocket                    disable the lua socket library",
     "   --output-comment=STRING       use STRING for DVI file comment instead of date (no effect for PDF)",
     "   --output-directory=DIR        use existing DIR as the directory to write files in",
@@ -88,6 +92,8 @@ const_string LUATEX_IHELP[] = {
     "   --progname=STRING             set the program name to STRING",
     "   --recorder                    enable filename recorder",
     "   --safer                       disable easily exploitable lua commands",
+    "   --server=SOCKET               load the format once and fork a job for every client connecting to SOCKET",
+    "   --server-lua=FILE             run lua FILE in the server before waiting for clients",
     "   --[no-]shell-escape           disable/enable system commands",
     "   --shell-restricted            restrict system commands to a list of commands given in texmf.cnf",
     "   --synctex=NUMBER              enable synctex (see man synctex)",
@@ -201,6 +207,8 @@ char *jithash_hashname = NULL;
 int safer_option = 0;
 int nosocket_option = 0;
 int utc_option = 0;
+int lua_pool_option = 0;
+int buffered_input_option = 0;
 
 /*tex
 
@@ -223,6 +231,8 @@ static struct option long_options[] = {
     {"lua", 1, 0, 0},
     {"luaonly", 0, 0, 0},
     {"luahashchars", 0, 0, 0},
+    {"lua-pool", 0, &lua_pool_option, 1},
+    {"buffered-input", 0, &buffered_input_option, 1},
 #ifdef LuajitTeX
     {"jiton", 0, 0, 0},
     {"jithash", 1, 0, 0},
@@ -250,6 +260,7 @@ static struct option long_options[] = {
     {"disable-write18", 0, &shellenabledp, -1},
     {"shell-restricted", 0, 0, 0},
     {"debug-format", 0, &debug_format_file, 1},
+    {"native-format", 0, &native_format, 1},
     {"file-line-error-style", 0, &filelineerrorstylep, 1},
     {"no-file-line-error-style", 0, &filelineerrorstylep, -1},
     /*tex Shorter option names for the above. */
@@ -265,6 +276,8 @@ static struct option long_options[] = {
     {"no-mktex", 1, 0, 0},
     /*tex Synchronization: just like ``interaction'' above */
     {"synctex", 1, 0, 0},
+    {"server", 1, 0, 0},
+    {"server-lua", 1, 0, 0},
     {0, 0, 0, 0}
 };
 
@@ -416,6 +429,10 @@ static void parse_options(int ac, char **av)
             synctexoption = (int) strtol(optarg, NULL, 0);
         } else if (ARGUMENT_IS("recorder")) {
             recorderoption = 1 ;
+        } else if (ARGUMENT_IS("server")) {
+            server_socket = optarg;
+        } else if (ARGUMENT_IS("server-lua")) {
+            server_lua = optarg;
         } else if (ARGUMENT_IS("help")) {
             usagehelp(LUATEX_IHELP, BUG_ADDRESS);
         } else if (ARGUMENT_IS("version")) {
@@ -1155,6 +1172,61 @@ void lua_initialize(int ac, char **av)
     }
 }
 
+/*tex
+
+    A server (see |fork_server|) runs an optional \LUA\ file after the format
+    has been loaded, which is the place to preload fonts and modules that all
+    jobs share.
+
+*/
+
+void lua_server_warmup(char *name)
+{
+    char *filename = find_filename(name, "LUATEXDIR");
+    if (filename == NULL) {
+        fprintf(stdout, "Server file %s not found\n", name);
+        exit(1);
+    }
+    if (luaL_loadfile(Luas, filename)) {
+        fprintf(stdout, "%s\n", lua_tostring(Luas, -1));
+        exit(1);
+    }
+    if (lua_pcall(Luas, 0, 0, 0)) {
+        fprintf(stdout, "%s\n", lua_tostring(Luas, -1));
+        lua_traceback(Luas);
+        exit(1);
+    }
+}
+
+/*tex
+
+    A job forked off a server gets the command line of its client. The options
+    given to the server act as defaults, only the job name and input file are
+    reset. Options that only matter at startup, like the format, are ignored.
+
+*/
+
+void lua_job_options(int ac, char **av)
+{
+    argc = ac;
+    argv = av;
+    c_job_name = NULL;
+    input_name = NULL;
+    lua_offset = 0;
+    /*tex Make |getopt| start from scratch. */
+    optind = 0;
+    parse_options(ac, av);
+    server_socket = NULL;
+    server_lua = NULL;
+    if (interactionoption != unspecified_mode) {
+        interaction = interactionoption;
+    }
+    if (recorderoption) {
+        recorder_enabled = 1;
+    }
+    prepare_cmdline(Luas, argv, argc, lua_offset);
+}
+
 void check_texconfig_init(void)
 {
     if (Luas != NULL) {
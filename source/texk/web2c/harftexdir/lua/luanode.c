@@ -89,8 +89,6 @@ void lua_node_filter(int filterid, int extrainfo, halfword head_node, halfword *
         start_done = nodelist_from_lua(Luas,-1);
         try_couple_nodes(head_node,start_done);
     }
-    /*tex redundant as we set top anyway */
-    lua_pop(Luas, 2);
     /*tex find tail in order to update tail */
     start_node = vlink(head_node);
     if (start_node != null) {
@@ -140,13 +138,13 @@ int lua_linebreak_callback(int is_broken, halfword head_node, halfword * new_hea
         luatex_error(Luas, (i == LUA_ERRRUN ? 0 : 1));
         return ret;
     }
-    lua_settop(Luas, s_top);
     p = lua_touserdata(Luas, -1);
     if (p != NULL) {
         a = nodelist_from_lua(Luas,-1);
         try_couple_nodes(*new_head,a);
         ret = 1;
     }
+    lua_settop(Luas, s_top);
     return ret;
 }
 
@@ -186,6 +184,7 @@ int lua_appendtovlist_callback(halfword box, int location, halfword prev_depth,
         p = check_isnode(Luas, -1);
         *result = *p;
     }
+    lua_settop(Luas, s_top);
     return 1;
 }
 
@@ -26,6 +26,10 @@ with LuaTeX; if not, see <http://www.gnu.org/licenses/>.
 #include "lua/luatex-api.h"
 #ifdef LuajitTeX
 #include "lua/lauxlib_bridge.h"
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
 #endif
 
 lua_State *Luas = NULL;
@@ -110,6 +114,9 @@ static void *my_luaalloc(void *ud, void *ptr, size_t osize, size_t nsize)
     void *ret = NULL;
     /*tex define |ud| for -Wunused */
     (void) ud;
+    /*tex For a new block |osize| is the kind of object, not a size. */
+    if (ptr == NULL)
+        osize = 0;
     if (nsize == 0)
         free(ptr);
     else
@@ -117,8 +124,244 @@ static void *my_luaalloc(void *ud, void *ptr, size_t osize, size_t nsize)
     luastate_bytes += (int) (nsize - osize);
     return ret;
 }
+
+/*tex
+
+    With |--lua-pool| small blocks, which is most of what \LUA\ allocates
+    (strings, tables, closures and node userdata), come from pages that hold
+    blocks of one size class only. Free blocks are kept in a list per page,
+    so allocating and releasing them is a matter of a few pointer
+    assignments, and blocks of the same size stay together, which fights
+    fragmentation in long runs. Pages are aligned to their size so that a
+    block finds its page by masking the address. A page that becomes empty
+    is given back to the system, except for one spare per class. As \LUA\
+    always passes the old size of a block, that size tells if a block is
+    pooled or not.
+
+*/
+
+#define LUA_POOL_GRANULE  16
+#define LUA_POOL_CLASSES  16
+#define LUA_POOL_MAX      (LUA_POOL_GRANULE * LUA_POOL_CLASSES)
+#define LUA_POOL_PAGE     65536
+
+#define lua_pool_class_of(s) ((int) (((s) - 1) / LUA_POOL_GRANULE))
+#define lua_pool_size_of(c)  ((size_t) ((c) + 1) * LUA_POOL_GRANULE)
+
+typedef struct lua_pool_page {
+    /*tex The neighbours in the list of pages with room. */
+    struct lua_pool_page *prev;
+    struct lua_pool_page *next;
+    /*tex Released blocks, and where never used blocks start. */
+    void *free;
+    char *bump;
+    int used;
+    int full;
+} lua_pool_page;
+
+#define LUA_POOL_START ((sizeof(lua_pool_page) + LUA_POOL_GRANULE - 1) & ~(size_t) (LUA_POOL_GRANULE - 1))
+
+typedef struct {
+    lua_pool_page *pages;
+    lua_pool_page *spare;
+    int blocks;
+    int page_count;
+    int allocations;
+} lua_pool_class;
+
+static lua_pool_class lua_pool[LUA_POOL_CLASSES];
+
+static lua_pool_page *lua_pool_map_page(void)
+{
+#ifdef _WIN32
+    /*tex The allocation granularity of |VirtualAlloc| is 64K. */
+    return VirtualAlloc(NULL, LUA_POOL_PAGE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    /*tex We map twice the size and trim to an aligned page. */
+    char *p = mmap(NULL, 2 * LUA_POOL_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char *q;
+    if (p == MAP_FAILED)
+        return NULL;
+    q = (char *) (((uintptr_t) p + LUA_POOL_PAGE - 1) & ~(uintptr_t) (LUA_POOL_PAGE - 1));
+    if (q > p)
+        munmap(p, (size_t) (q - p));
+    munmap(q + LUA_POOL_PAGE, (size_t) (p + LUA_POOL_PAGE - q));
+    return (lua_pool_page *) q;
+#endif
+}
+
+static void lua_pool_unmap_page(lua_pool_page *p)
+{
+#ifdef _WIN32
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    munmap(p, LUA_POOL_PAGE);
+#endif
+}
+
+static void lua_pool_link(lua_pool_class *pc, lua_pool_page *p)
+{
+    p->prev = NULL;
+    p->next = pc->pages;
+    if (pc->pages != NULL)
+        pc->pages->prev = p;
+    pc->pages = p;
+}
+
+static void lua_pool_unlink(lua_pool_class *pc, lua_pool_page *p)
+{
+    if (p->prev != NULL)
+        p->prev->next = p->next;
+    else
+        pc->pages = p->next;
+    if (p->next != NULL)
+        p->next->prev = p->prev;
+}
+
+static void *lua_pool_get(int c)
+{
+    lua_pool_class *pc = &lua_pool[c];
+    lua_pool_page *p = pc->pages;
+    size_t size = lua_pool_size_of(c);
+    void *b;
+    if (p == NULL) {
+        if (pc->spare != NULL) {
+            p = pc->spare;
+            pc->spare = NULL;
+        } else {
+            p = lua_pool_map_page();
+            if (p == NULL)
+                return NULL;
+            pc->page_count++;
+        }
+        p->free = NULL;
+        p->bump = (char *) p + LUA_POOL_START;
+        p->used = 0;
+        p->full = 0;
+        lua_pool_link(pc, p);
+    }
+    if (p->free != NULL) {
+        b = p->free;
+        p->free = *(void **) b;
+    } else {
+        b = p->bump;
+        p->bump += size;
+    }
+    p->used++;
+    pc->blocks++;
+    pc->allocations++;
+    if (p->free == NULL && p->bump + size > (char *) p + LUA_POOL_PAGE) {
+        p->full = 1;
+        lua_pool_unlink(pc, p);
+    }
+    return b;
+}
+
+static void lua_pool_put(void *b, int c)
+{
+    lua_pool_class *pc = &lua_pool[c];
+    lua_pool_page *p = (lua_pool_page *) ((uintptr_t) b & ~(uintptr_t) (LUA_POOL_PAGE - 1));
+    *(void **) b = p->free;
+    p->free = b;
+    p->used--;
+    pc->blocks--;
+    if (p->full) {
+        p->full = 0;
+        lua_pool_link(pc, p);
+    }
+    if (p->used == 0) {
+        lua_pool_unlink(pc, p);
+        if (pc->spare == NULL) {
+            pc->spare = p;
+        } else {
+            lua_pool_unmap_page(p);
+            pc->page_count--;
+        }
+    }
+}
+
+static void *my_luapoolalloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    void *ret = NULL;
+    (void) ud;
+    if (ptr == NULL)
+        osize = 0;
+    if (nsize == 0) {
+        if (ptr == NULL)
+            return NULL;
+        else if (osize <= LUA_POOL_MAX)
+            lua_pool_put(ptr, lua_pool_class_of(osize));
+        else
+            free(ptr);
+    } else if (nsize <= LUA_POOL_MAX) {
+        if (ptr != NULL && osize <= LUA_POOL_MAX && lua_pool_class_of(osize) == lua_pool_class_of(nsize)) {
+            ret = ptr;
+        } else {
+            ret = lua_pool_get(lua_pool_class_of(nsize));
+            if (ret == NULL) {
+                if (osize >= nsize) {
+                    /*tex \LUA\ assumes that shrinking never fails. */
+                    fprintf(stderr, "fatal: memory exhausted\n");
+                    exit(EXIT_FAILURE);
+                }
+                return NULL;
+            }
+            if (ptr != NULL) {
+                memcpy(ret, ptr, osize < nsize ? osize : nsize);
+                if (osize <= LUA_POOL_MAX)
+                    lua_pool_put(ptr, lua_pool_class_of(osize));
+                else
+                    free(ptr);
+            }
+        }
+    } else if (ptr != NULL && osize > LUA_POOL_MAX) {
+        ret = realloc(ptr, nsize);
+    } else {
+        ret = malloc(nsize);
+        if (ret != NULL && ptr != NULL) {
+            memcpy(ret, ptr, osize);
+            lua_pool_put(ptr, lua_pool_class_of(osize));
+        }
+    }
+    if (ret != NULL || nsize == 0)
+        luastate_bytes += (int) (nsize - osize);
+    return ret;
+}
+
 #endif
 
+/*tex
+
+    The counters of the pool end up in |status.luapool|: a table per size
+    class with the block size, the blocks in use, the mapped pages and the
+    number of allocations so far.
+
+*/
+
+void lua_pool_status(lua_State *L)
+{
+#ifndef LuajitTeX
+    int c;
+    if (lua_pool_option) {
+        lua_createtable(L, LUA_POOL_CLASSES, 0);
+        for (c = 0; c < LUA_POOL_CLASSES; c++) {
+            lua_createtable(L, 0, 4);
+            lua_pushinteger(L, (lua_Integer) lua_pool_size_of(c));
+            lua_setfield(L, -2, "size");
+            lua_pushinteger(L, lua_pool[c].blocks);
+            lua_setfield(L, -2, "blocks");
+            lua_pushinteger(L, lua_pool[c].page_count);
+            lua_setfield(L, -2, "pages");
+            lua_pushinteger(L, lua_pool[c].allocations);
+            lua_setfield(L, -2, "allocations");
+            lua_rawseti(L, -2, c + 1);
+        }
+        return;
+    }
+#endif
+    lua_pushnil(L);
+}
+
 static int my_luapanic(lua_State * L)
 {
     /*tex define |L| to avoid warnings */
@@ -130,6 +373,7 @@ static int my_luapanic(lua_State * L)
 void luafunctioncall(int slot)
 {
     int i ;
+    callback_profile_mark m;
     int stacktop = lua_gettop(Luas);
     lua_active++;
     lua_rawgeti(Luas, LUA_REGISTRYINDEX, lua_key_index(lua_functions));
@@ -144,7 +388,9 @@ void luafunctioncall(int slot)
         /*tex put it under chunk  */
         lua_insert(Luas, base);
         ++function_callback_count;
+        callback_profile_start(&m);
         i = lua_pcall(Luas, 1, 0, base);
+        callback_profile_stop(profile_luafunction, &m);
         /*tex remove traceback function */
         lua_remove(Luas, base);
         if (i != 0) {
@@ -296,7 +542,7 @@ void luainterpreter(void)
     }
     L = luaL_newstate() ;
 #else
-    L = lua_newstate(my_luaalloc, NULL);
+    L = lua_newstate(lua_pool_option ? my_luapoolalloc : my_luaalloc, NULL);
 #endif
     if (L == NULL) {
         fprintf(stderr, "Can't create the Lua state.\n");
@@ -445,6 +691,7 @@ static void luacall(int p, int nameptr, boolean is_string)
 {
     LoadS ls;
     int i;
+    callback_profile_mark m;
     size_t ll = 0;
     char *lua_id;
     char *s = NULL;
@@ -465,7 +712,9 @@ static void luacall(int p, int nameptr, boolean is_string)
             /*tex put it under chunk  */
             lua_insert(Luas, base);
             ++late_callback_count;
+            callback_profile_start(&m);
             i = lua_pcall(Luas, 0, 0, base);
+            callback_profile_stop(profile_latelua, &m);
             /*tex remove traceback function */
             lua_remove(Luas, base);
             if (i != 0) {
@@ -515,7 +764,9 @@ static void luacall(int p, int nameptr, boolean is_string)
             /*tex put it under chunk  */
             lua_insert(Luas, base);
             ++late_callback_count;
+            callback_profile_start(&m);
             i = lua_pcall(Luas, 0, 0, base);
+            callback_profile_stop(profile_latelua, &m);
             /*tex remove traceback function */
             lua_remove(Luas, base);
             if (i != 0) {
@@ -614,6 +865,7 @@ void luatokencall(int p, int nameptr)
 {
     LoadS ls;
     int i;
+    callback_profile_mark m;
     int l = 0;
     char *s = NULL;
     char *lua_id;
@@ -649,7 +901,9 @@ void luatokencall(int p, int nameptr)
             /*tex put it under chunk  */
             lua_insert(Luas, base);
             ++direct_callback_count;
+            callback_profile_start(&m);
             i = lua_pcall(Luas, 0, 0, base);
+            callback_profile_stop(profile_directlua, &m);
             /*tex remove traceback function */
             lua_remove(Luas, base);
             if (i != 0) {
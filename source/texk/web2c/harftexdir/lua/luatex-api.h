@@ -117,6 +117,8 @@ extern int getinputfilecallbackid(int n);
 extern int getreadfilecallbackid(int n);
 
 extern void lua_initialize(int ac, char **av);
+extern void lua_server_warmup(char *name);
+extern void lua_job_options(int ac, char **av);
 
 extern void luacall_vf(int p, int f, int c);
 
@@ -191,6 +193,7 @@ extern void luainterpreter(void);
 extern int luabytecode_max;
 extern unsigned int luabytecode_bytes;
 extern int luastate_bytes;
+extern void lua_pool_status(lua_State *L);
 
 extern int callback_count;
 extern int saved_callback_count;
@@ -214,6 +217,8 @@ extern char *startup_filename;
 extern int safer_option;
 extern int nosocket_option;
 extern int utc_option;
+extern int lua_pool_option;
+extern int buffered_input_option;
 
 extern char *last_source_name;
 extern int last_lineno;
@@ -67,6 +67,15 @@ const char *harftex_version_string = "0.4.1";
 
 #include <signal.h>             /* Catch interrupts.  */
 
+#ifndef WIN32
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  include <sys/wait.h>
+#  include <poll.h>
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#endif
+
 /*
     Shell escape.
 
@@ -537,6 +546,11 @@ const_string c_job_name;
 
 const char *luatex_banner;
 
+/* The socket and warm-up file of |--server|, if given. */
+
+char *server_socket = NULL;
+char *server_lua = NULL;
+
 #ifdef _MSC_VER
 /* Invalid parameter handler */
 static void myInvalidParameterHandler(const wchar_t * expression,
@@ -558,6 +572,403 @@ static void myInvalidParameterHandler(const wchar_t * expression,
 }
 #endif
 
+/*
+    Fork server.
+
+    Every job parses \.{texmf.cnf}, sets up \LUA, undumps the format and loads
+    whatever the macro package wants on top of that, which is the same for all
+    jobs in a batch. With |--server=SOCKET| the engine does this once, runs the
+    optional |--server-lua| file (preloading fonts and modules) and then waits
+    on a local socket. Each request is handled by a child process that starts
+    out from this warm state. A request is sent by running the engine with
+    |--client=SOCKET| as first argument: it passes its working directory, its
+    arguments and its standard streams and exits with the status of the job.
+    When no server is listening, the client runs the job itself.
+
+    A request is a header with a magic number and a size, followed by the
+    working directory and the arguments, each terminated by a zero byte. The
+    three standard file descriptors travel along with the header. The reply is
+    the exit status of the job. Jobs inherit the environment of the server.
+*/
+
+#ifndef WIN32
+
+#define SERVER_MAGIC 0x4C544A31
+#define SERVER_MAX_REQUEST (1 << 20)
+
+typedef struct {
+    pid_t pid;
+    int conn;
+    int hungup;
+} server_job;
+
+static int server_pipe[2] = { -1, -1 };
+
+static RETSIGTYPE catch_child(int arg)
+{
+    int saved = errno;
+    /* When the pipe is full a wakeup is pending anyway. */
+    ssize_t done = write(server_pipe[1], "", 1);
+    (void) arg;
+    (void) done;
+    errno = saved;
+}
+
+static int write_fully(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *) data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        p += n;
+        size -= (size_t) n;
+    }
+    return 1;
+}
+
+static int read_fully(int fd, void *data, size_t size)
+{
+    char *p = (char *) data;
+    while (size > 0) {
+        /* The parentheses get us past the |read| macro of cpascal.h. */
+        ssize_t n = (read)(fd, p, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 0;
+        p += n;
+        size -= (size_t) n;
+    }
+    return 1;
+}
+
+static int server_address(const char *name, struct sockaddr_un *addr)
+{
+    if (strlen(name) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "! Socket name %s is too long.\n", name);
+        return 0;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, name);
+    return 1;
+}
+
+/*
+    The client. We only return when there is no server, in which case the
+    caller drops the |--client| argument and carries on as usual.
+*/
+
+static void run_client(const char *name, int ac, char **av)
+{
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    unsigned int head[2];
+    int fds[3] = { 0, 1, 2 };
+    int code = EXIT_FAILURE;
+    char *cwd, *data, *p;
+    size_t size;
+    int i, fd;
+    if (!server_address(name, &addr))
+        return;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return;
+    }
+    /* The working directory, the program name and the remaining arguments. */
+    cwd = xgetcwd();
+    size = strlen(cwd) + 1 + strlen(av[0]) + 1;
+    for (i = 2; i < ac; i++)
+        size += strlen(av[i]) + 1;
+    if (size > SERVER_MAX_REQUEST) {
+        fprintf(stderr, "! Too many arguments for the server at %s.\n", name);
+        uexit(EXIT_FAILURE);
+    }
+    data = p = xmalloc(size);
+    strcpy(p, cwd);
+    p += strlen(cwd) + 1;
+    strcpy(p, av[0]);
+    p += strlen(av[0]) + 1;
+    for (i = 2; i < ac; i++) {
+        strcpy(p, av[i]);
+        p += strlen(av[i]) + 1;
+    }
+    head[0] = SERVER_MAGIC;
+    head[1] = (unsigned int) size;
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = head;
+    iov.iov_len = sizeof(head);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(fd, &msg, 0) == (ssize_t) sizeof(head) && write_fully(fd, data, size)) {
+        if (!read_fully(fd, &code, sizeof(code))) {
+            fprintf(stderr, "! The server at %s dropped the job.\n", name);
+            code = EXIT_FAILURE;
+        }
+    } else {
+        fprintf(stderr, "! Unable to send the job to the server at %s.\n", name);
+    }
+    exit(code);
+}
+
+/*
+    The server side of a request: the header with the descriptors and then the
+    strings. We don't trust the client more than needed.
+*/
+
+static char *receive_request(int conn, int *fds, size_t *size)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    unsigned int head[2];
+    ssize_t n;
+    char *data;
+    int i, nfds = 0;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = head;
+    iov.iov_len = sizeof(head);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    do {
+        n = recvmsg(conn, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return NULL;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            if (nfds > 3)
+                nfds = 3;
+            memcpy(fds, CMSG_DATA(cmsg), (size_t) nfds * sizeof(int));
+        }
+    }
+    if (nfds != 3 || (msg.msg_flags & MSG_CTRUNC)
+        || !read_fully(conn, (char *) head + n, sizeof(head) - (size_t) n)
+        || head[0] != SERVER_MAGIC || head[1] == 0 || head[1] > SERVER_MAX_REQUEST) {
+        for (i = 0; i < nfds; i++)
+            close(fds[i]);
+        return NULL;
+    }
+    *size = head[1];
+    data = xmalloc(*size + 1);
+    if (!read_fully(conn, data, *size)) {
+        for (i = 0; i < 3; i++)
+            close(fds[i]);
+        free(data);
+        return NULL;
+    }
+    data[*size] = 0;
+    return data;
+}
+
+/*
+    In the child we take over the streams, the working directory and the
+    arguments of the client. The request buffer stays around because |argv|
+    points into it.
+*/
+
+static void start_job(char *data, size_t size, int *fds)
+{
+    char **av;
+    char *p;
+    int i, ac = 0;
+    for (i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        if (fds[i] > 2)
+            close(fds[i]);
+    }
+    clearerr(stdin);
+    for (p = data + strlen(data) + 1; p < data + size; p += strlen(p) + 1)
+        ac++;
+    if (ac == 0 || chdir(data) != 0) {
+        fprintf(stderr, "! Unable to start the job in %s.\n", data);
+        uexit(EXIT_FAILURE);
+    }
+    av = xmalloc((unsigned) (ac + 1) * sizeof(char *));
+    for (i = 0, p = data + strlen(data) + 1; i < ac; i++, p += strlen(p) + 1)
+        av[i] = p;
+    av[ac] = NULL;
+    lua_job_options(ac, av);
+    /* A job has its own clock unless |SOURCE_DATE_EPOCH| says otherwise. */
+    start_time = -1;
+    init_start_time();
+}
+
+/*
+    This is called after the format has been loaded. It returns |false| when
+    there is no server to run and |true| in a forked job, which then continues
+    the run as if it was started from the command line. The server itself only
+    ends when it gets killed or can't listen.
+*/
+
+boolean fork_server(void)
+{
+    struct sockaddr_un addr;
+    server_job *jobs = NULL;
+    struct pollfd *polls = NULL;
+    int jobs_used = 0;
+    int jobs_size = 0;
+    int listener, i;
+    mode_t mask;
+    if (server_socket == NULL)
+        return false;
+    if (server_lua != NULL)
+        lua_server_warmup(server_lua);
+    if (!server_address(server_socket, &addr))
+        uexit(EXIT_FAILURE);
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(server_socket);
+    /* Only the owner may hand us jobs. */
+    mask = umask(077);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+        fprintf(stderr, "! Unable to listen on %s: %s.\n", server_socket, strerror(errno));
+        uexit(EXIT_FAILURE);
+    }
+    umask(mask);
+    if (pipe(server_pipe) < 0) {
+        fprintf(stderr, "! Unable to set up the server: %s.\n", strerror(errno));
+        uexit(EXIT_FAILURE);
+    }
+    fcntl(server_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(server_pipe[1], F_SETFL, O_NONBLOCK);
+    signal(SIGCHLD, catch_child);
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(term_out, "Waiting for jobs on %s\n", server_socket);
+    fflush(term_out);
+    while (1) {
+        int n = 2;
+        polls = xrealloc(polls, (unsigned) (jobs_used + 2) * sizeof(struct pollfd));
+        polls[0].fd = listener;
+        polls[0].events = POLLIN;
+        polls[1].fd = server_pipe[0];
+        polls[1].events = POLLIN;
+        for (i = 0; i < jobs_used; i++) {
+            /* A client that goes away takes its job along. */
+            polls[n].fd = jobs[i].hungup ? -1 : jobs[i].conn;
+            polls[n].events = POLLIN;
+            n++;
+        }
+        if (poll(polls, (nfds_t) n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "! Server failure: %s.\n", strerror(errno));
+            uexit(EXIT_FAILURE);
+        }
+        for (i = 0; i < jobs_used; i++) {
+            if (!jobs[i].hungup && polls[i + 2].revents) {
+                kill(jobs[i].pid, SIGTERM);
+                jobs[i].hungup = 1;
+            }
+        }
+        if (polls[1].revents) {
+            char drain[64];
+            pid_t pid;
+            int status;
+            while ((read)(server_pipe[0], drain, sizeof(drain)) > 0);
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                for (i = 0; i < jobs_used; i++) {
+                    if (jobs[i].pid == pid) {
+                        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                        write_fully(jobs[i].conn, &code, sizeof(code));
+                        close(jobs[i].conn);
+                        jobs[i] = jobs[--jobs_used];
+                        break;
+                    }
+                }
+            }
+        }
+        if (polls[0].revents & POLLIN) {
+            int fds[3];
+            size_t size = 0;
+            char *data;
+            pid_t pid;
+            int conn = accept(listener, NULL, NULL);
+            if (conn < 0)
+                continue;
+            data = receive_request(conn, fds, &size);
+            if (data == NULL) {
+                close(conn);
+                continue;
+            }
+            fflush(stdout);
+            fflush(stderr);
+            pid = fork();
+            if (pid == 0) {
+                close(listener);
+                close(server_pipe[0]);
+                close(server_pipe[1]);
+                for (i = 0; i < jobs_used; i++)
+                    close(jobs[i].conn);
+                close(conn);
+                free(jobs);
+                free(polls);
+                signal(SIGCHLD, SIG_DFL);
+                signal(SIGPIPE, SIG_DFL);
+                server_socket = NULL;
+                server_lua = NULL;
+                start_job(data, size, fds);
+                return true;
+            }
+            for (i = 0; i < 3; i++)
+                close(fds[i]);
+            free(data);
+            if (pid < 0) {
+                int code = EXIT_FAILURE;
+                fprintf(stderr, "! Unable to fork a job: %s.\n", strerror(errno));
+                write_fully(conn, &code, sizeof(code));
+                close(conn);
+            } else {
+                if (jobs_used == jobs_size) {
+                    jobs_size = jobs_size ? 2 * jobs_size : 16;
+                    jobs = xrealloc(jobs, (unsigned) jobs_size * sizeof(server_job));
+                }
+                jobs[jobs_used].pid = pid;
+                jobs[jobs_used].conn = conn;
+                jobs[jobs_used].hungup = 0;
+                jobs_used++;
+            }
+        }
+    }
+}
+
+#else
+
+boolean fork_server(void)
+{
+    if (server_socket != NULL)
+        fprintf(stderr, "! The server mode is not available on this platform.\n");
+    return false;
+}
+
+#endif
+
 /*
     The entry point: set up for reading the command line, which will happen in
     `topenin', then call the main body.
@@ -589,6 +1000,19 @@ main (int ac, string *av)
     setmode(fileno(stdin), _O_BINARY);
 #  endif
 
+#  ifndef WIN32
+    /*
+        A client hands its job to a server and only runs it itself when there
+        is no server listening.
+    */
+    if (ac > 1 && (strncmp(av[1], "--client=", 9) == 0 || strncmp(av[1], "-client=", 8) == 0)) {
+        run_client(strchr(av[1], '=') + 1, ac, av);
+        av[1] = av[0];
+        av++;
+        ac--;
+    }
+#  endif
+
     lua_initialize(ac, av);
 
 #  ifdef WIN32
@@ -859,6 +1283,120 @@ int getrandomseed(void)
 #endif
 }
 
+/*
+    With --buffered-input, regular input files are read into memory with a
+    single block read the first time we need a line from them, and line ends
+    are then found by scanning memory instead of a getc per character. The
+    block is released when the file is closed (see close_file_or_pipe). A block
+    is only made for a file that is still at its start, so a file that found
+    all slots taken is read with getc until it is closed instead of switching
+    halfway.
+*/
+
+typedef struct {
+    FILE *f;
+    unsigned char *data;
+    size_t size;
+    size_t pos;
+} input_block;
+
+#define MAX_INPUT_BLOCKS 64
+
+static input_block input_blocks[MAX_INPUT_BLOCKS];
+
+static input_block *get_input_block(FILE * f)
+{
+    struct stat st;
+    size_t size, n;
+    input_block *b = NULL;
+    int i;
+    for (i = 0; i < MAX_INPUT_BLOCKS; i++) {
+        if (input_blocks[i].f == f)
+            return &input_blocks[i];
+        else if (b == NULL && input_blocks[i].f == NULL)
+            b = &input_blocks[i];
+    }
+    if (b == NULL || fileno(f) == fileno(stdin)
+        || fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) || ftell(f) != 0)
+        return NULL;
+    /*
+        The size is only a hint, we read until end of file in case the file
+        grew in the meantime.
+    */
+    size = (size_t) st.st_size + 1;
+    b->data = xmalloc(size);
+    b->size = 0;
+    while ((n = fread(b->data + b->size, 1, size - b->size, f)) > 0) {
+        b->size += n;
+        if (b->size == size) {
+            size *= 2;
+            b->data = xrealloc(b->data, size);
+        }
+    }
+    b->pos = 0;
+    b->f = f;
+    return b;
+}
+
+void release_input_block(FILE * f)
+{
+    int i;
+    for (i = 0; i < MAX_INPUT_BLOCKS; i++) {
+        if (input_blocks[i].f == f) {
+            free(input_blocks[i].data);
+            input_blocks[i].data = NULL;
+            input_blocks[i].f = NULL;
+            return;
+        }
+    }
+}
+
+/*
+    The same line splitting as input_line below, but on a block of memory: we
+    set `last' and advance `pos' past the line terminator. A line that doesn't
+    fit makes the buffer grow, as for lines that come from a Lua reader.
+*/
+
+boolean input_block_line(const unsigned char *data, size_t size, size_t *pos)
+{
+    const unsigned char *s = data + *pos;
+    const unsigned char *e = s;
+    const unsigned char *t = data + size;
+    size_t n;
+    last = first;
+    if (s == t)
+        return false;
+    /*
+        One pass that stops at the first LF or CR; looking for each of them
+        over the rest of the block would make CR-only files quadratic.
+    */
+    while (e < t && *e != '\n' && *e != '\r')
+        e++;
+    n = (size_t) (e - s);
+    if (n >= (size_t) (INT_MAX / 2 - first)) {
+        fprintf(stderr, "! Unable to read an entire line---length=%lu.\n",
+                (unsigned long) n);
+        uexit(1);
+    }
+    check_buffer_overflow(first + (int) n + 1);
+    memcpy(buffer + first, s, n);
+    last = first + (int) n;
+    *pos += n;
+    if (e < t && *e == '\r') {
+        /* A CR, possibly followed by the LF of a CRLF. */
+        if (++(*pos) < size && data[*pos] == '\n')
+            (*pos)++;
+    } else if (e < t) {
+        (*pos)++;
+    }
+    buffer[last] = ' ';
+    if (last >= max_buf_stack)
+        max_buf_stack = last;
+    while (last > first && buffer[last - 1] == ' ')
+        --last;
+    return true;
+}
+
 /*
     Read a line of input as efficiently as possible while still looking like
     Pascal. We set `last' to `first' and return `false' if we get to eof.
@@ -899,6 +1437,11 @@ boolean input_line(FILE * f)
         }
     }
 #endif
+    if (buffered_input_option) {
+        input_block *b = get_input_block(f);
+        if (b != NULL)
+            return input_block_line(b->data, b->size, &b->pos);
+    }
     /*
         Recognize either LF or CR as a line terminator.
     */
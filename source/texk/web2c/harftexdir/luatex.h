@@ -79,6 +79,11 @@ extern boolean get_start_time(void);
 extern int shell_cmd_is_allowed(const char *cmd, char **safecmd,
                                 char **cmdname);
 
+/* Serving jobs from a warm engine.  */
+extern char *server_socket;
+extern char *server_lua;
+extern boolean fork_server(void);
+
 
 #if defined(WIN32) && !defined(__MINGW32__) && defined(DLLPROC)
 extern __declspec(dllexport) int DLLPROC (int ac, string *av);
@@ -106,6 +111,8 @@ extern void ipcpage(int);
 #  define	input_ln(stream, flag) input_line (stream)
 
 extern boolean input_line(FILE *);
+extern boolean input_block_line(const unsigned char *data, size_t size, size_t *pos);
+extern void release_input_block(FILE *);
 
 #  define COPYRIGHT_HOLDER "Taco Hoekwater"
 #  define AUTHOR NULL
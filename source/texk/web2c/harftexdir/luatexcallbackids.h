@@ -91,7 +91,30 @@ extern int lua_active;
 
 extern int debug_callback_defined(int i);
 
+/*tex Profiling slots for \LUA\ code that is not run as a callback. */
+
+typedef enum {
+    profile_directlua = total_callbacks,
+    profile_latelua,
+    profile_luafunction,
+    profile_saved_callback,
+    total_profile_slots,
+} profile_slots;
+
+typedef struct callback_profile_mark {
+    int started;
+    int seconds;
+    int micros;
+    int bytes;
+} callback_profile_mark;
+
+extern int callback_profiling;
+extern void callback_profile_start(callback_profile_mark *m);
+extern void callback_profile_stop(int i, callback_profile_mark *m);
+extern void callback_profile_report(FILE * f);
+
 extern int run_callback(int i, const char *values, ...);
+extern int run_line_callback(int i, int len, int *bufloc);
 extern int run_saved_callback(int i, const char *name, const char *values, ...);
 extern int run_and_save_callback(int i, const char *values, ...);
 extern void destroy_saved_callback(int i);
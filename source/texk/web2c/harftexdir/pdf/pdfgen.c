@@ -137,6 +137,15 @@ void strbuf_flush(PDF pdf, strbuf_s * b)
     strbuf_seek(b, 0);
 }
 
+/*tex Append |n| bytes to a buffer. */
+
+static void strbuf_append(strbuf_s * b, const unsigned char *s, size_t n)
+{
+    strbuf_room(b, n);
+    memcpy(b->p, s, n);
+    b->p += n;
+}
+
 /*tex We free all dynamically allocated buffer structures. */
 
 void strbuf_free(strbuf_s * b)
@@ -323,6 +332,8 @@ static void write_zip(PDF pdf)
             zip_len = ZIP_BUF_SIZE - s->avail_out;
             pdf->gone += (off_t) xfwrite(pdf->zipbuf, 1, zip_len, pdf->file);
             pdf->last_byte = pdf->zipbuf[zip_len - 1];
+            if (pdf->capture != NULL && pdf->capture->capturing)
+                strbuf_append(pdf->capture->data, (const unsigned char *) pdf->zipbuf, zip_len);
             s->next_out = (Bytef *) pdf->zipbuf;
             s->avail_out = ZIP_BUF_SIZE;
         }
@@ -363,6 +374,8 @@ static void write_nozip(PDF pdf)
     pdf->stream_length = pdf_offset(pdf) - pdf->save_offset;
     pdf->gone += (off_t) xfwrite((char *) buf->data, sizeof(char), l, pdf->file);
     pdf->last_byte = *(buf->p - 1);
+    if (pdf->capture != NULL && pdf->capture->capturing)
+        strbuf_append(pdf->capture->data, buf->data, l);
 }
 
 /*tex
@@ -524,57 +537,115 @@ void pdf_print(PDF pdf, str_number s)
     }
 }
 
+/*tex
+
+    Numbers end up in page streams by the thousands (positions, widths, font
+    sizes) so we don't go through |snprintf| but write the digits directly into
+    the buffer, two at a time, using a table of all pairs.
+
+*/
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static int count_digits(uint64_t n)
+{
+    int d = 1;
+    while (n >= 10000) {
+        n /= 10000;
+        d += 4;
+    }
+    if (n >= 1000)
+        return d + 3;
+    if (n >= 100)
+        return d + 2;
+    if (n >= 10)
+        return d + 1;
+    return d;
+}
+
+/*tex This writes the last |d| digits of |n|, padding with zeros when needed. */
+
+static void put_digits(unsigned char *s, uint64_t n, int d)
+{
+    unsigned char *p = s + d;
+    while (n >= 100 && p - s >= 2) {
+        int r = (int) (n % 100);
+        n /= 100;
+        p -= 2;
+        p[0] = (unsigned char) digit_pairs[2 * r];
+        p[1] = (unsigned char) digit_pairs[2 * r + 1];
+    }
+    while (p > s) {
+        *--p = (unsigned char) ('0' + n % 10);
+        n /= 10;
+    }
+}
+
+/*tex The room needed for a sign and the 20 digits of a 64 bit number: */
+
+#define max_number_room 21
+
+static void pdf_quick_uint(PDF pdf, uint64_t n)
+{
+    int d = count_digits(n);
+    put_digits(pdf->buf->p, n, d);
+    pdf->buf->p += d;
+}
+
 void pdf_print_int(PDF pdf, longinteger n)
 {
-    char s[24];
-    int w;
-    w = snprintf(s, 23, "%" LONGINTEGER_PRI "d", (LONGINTEGER_TYPE) n);
-    check_nprintf(w, 23);
-    pdf_out_block(pdf, (const char *) s, (size_t) w);
+    pdf_room(pdf, max_number_room);
+    if (n < 0) {
+        pdf_quick_out(pdf, '-');
+        pdf_quick_uint(pdf, (uint64_t) 0 - (uint64_t) n);
+    } else {
+        pdf_quick_uint(pdf, (uint64_t) n);
+    }
 }
 
+/*tex
+
+    A |pdffloat| has |e| decimals. Trailing zeros of the fraction are dropped, as
+    is the dot when nothing is left.
+
+*/
+
 void print_pdffloat(PDF pdf, pdffloat f)
 {
     int64_t m = f.m;
-    if (m == 0) {
-        pdf_out(pdf, '0');
+    int e = f.e;
+    uint64_t u;
+    pdf_room(pdf, 2 * max_number_room);
+    if (m < 0) {
+        pdf_quick_out(pdf, '-');
+        u = (uint64_t) 0 - (uint64_t) m;
     } else {
-        int e = f.e;
-        if (e == 0) {
-            /*tex division by |ten_pow[0] == 1| */
-            if (m == 1) {
-                pdf_out(pdf, '1');
-            } else {
-                char a[24];
-                snprintf(a, 23, "%" LONGINTEGER_PRI "i", (LONGINTEGER_TYPE) m);
-                pdf_puts(pdf, a);
-            }
-        } else {
-            int t = ten_pow[e] ;
-            if (t == m) {
-                pdf_out(pdf, '1');
-            } else {
-                int i, l, w;
-                char a[24];
-                if (m < 0) {
-                    pdf_out(pdf, '-');
-                    m *= -1;
-                }
-                l = m / t;
-                w = snprintf(a, 23, "%i", l);
-                pdf_out_block(pdf, (const char *) a, (size_t) w);
-                l = m % t;
-                if (l != 0) {
-                    pdf_out(pdf, '.');
-                    snprintf(a, 23, "%d", l + t);
-                    for (i = e; i > 0; i--) {
-                        if (a[i] != '0')
-                            break;
-                        a[i] = '\0';
-                    }
-                    pdf_puts(pdf, (a + 1));
-                }
+        u = (uint64_t) m;
+    }
+    if (e <= 0) {
+        pdf_quick_uint(pdf, u);
+    } else {
+        uint64_t t = (uint64_t) ten_pow[e];
+        uint64_t l = u % t;
+        pdf_quick_uint(pdf, u / t);
+        if (l != 0) {
+            while (l % 10 == 0) {
+                l /= 10;
+                e--;
             }
+            pdf_quick_out(pdf, '.');
+            put_digits(pdf->buf->p, l, e);
+            pdf->buf->p += e;
         }
     }
 }
@@ -614,6 +685,54 @@ void pdf_print_str(PDF pdf, const char *s)
     pdf_puts(pdf, orig);
 }
 
+/*tex
+
+    A capture collects the data of the streams that are written between
+    |pdf_begin_capture| and |pdf_end_capture|, as it ends up in the file. This
+    is used by caches that want to splice the same streams into a later run.
+    Nothing is collected in draft mode.
+
+*/
+
+stream_capture *pdf_begin_capture(PDF pdf)
+{
+    stream_capture *c = xtalloc(1, stream_capture);
+    memset(c, 0, sizeof(stream_capture));
+    c->data = new_strbuf(inf_pdfout_buf_size, 0x7FFFFFFF);
+    pdf->capture = c;
+    return c;
+}
+
+void pdf_end_capture(PDF pdf)
+{
+    pdf->capture = NULL;
+}
+
+void pdf_free_capture(stream_capture * c)
+{
+    if (c != NULL) {
+        strbuf_free(c->data);
+        xfree(c);
+    }
+}
+
+static void pdf_capture_stream(PDF pdf, int begin)
+{
+    stream_capture *c = pdf->capture;
+    if (begin) {
+        if (c->count < MAX_CAPTURED_STREAMS) {
+            c->capturing = true;
+            c->lengths[c->count] = strbuf_offset(c->data);
+        } else {
+            c->overflow = true;
+        }
+    } else if (c->capturing) {
+        c->capturing = false;
+        c->lengths[c->count] = strbuf_offset(c->data) - c->lengths[c->count];
+        c->count++;
+    }
+}
+
 /*tex A stream needs to have a stream dictionary also. */
 
 void pdf_begin_stream(PDF pdf)
@@ -621,6 +740,8 @@ void pdf_begin_stream(PDF pdf)
     pdf_puts(pdf, "\nstream\n");
     pdf_save_offset(pdf);
     pdf_flush(pdf);
+    if (pdf->capture != NULL)
+        pdf_capture_stream(pdf, true);
     if (pdf->stream_deflate) {
         pdf->zip_write_state = ZIP_WRITING;
     }
@@ -638,6 +759,8 @@ void pdf_end_stream(PDF pdf)
                 pdf->zip_write_state = ZIP_FINISH;
             /*tex This sets| pdf->last_byte|. */
             pdf_flush(pdf);
+            if (pdf->capture != NULL)
+                pdf_capture_stream(pdf, false);
             break;
         case OBJSTM_BUF:
             normal_error("pdf backend", "bad buffer in end stream, case 1");
@@ -2052,14 +2175,13 @@ static void check_nonexisting_destinations(PDF pdf)
 
 static void check_nonexisting_pages(PDF pdf)
 {
-    struct avl_traverser t;
-    oentry *p;
-    struct avl_table *page_tree = pdf->obj_tree[obj_type_page];
-    avl_t_init(&t, page_tree);
+    int i, n;
+    oentry *pages = sorted_int_objs(pdf, obj_type_page, &n);
     /*tex Search from the end backward until the last real page is found. */
-    for (p = avl_t_last(&t, page_tree); p != NULL && obj_aux(pdf, p->objptr) == 0; p = avl_t_prev(&t)) {
-        formatted_warning("pdf backend", "page %d has been referenced but does not exist",obj_info(pdf, p->objptr));
+    for (i = n - 1; i >= 0 && obj_aux(pdf, pages[i].objptr) == 0; i--) {
+        formatted_warning("pdf backend", "page %d has been referenced but does not exist",obj_info(pdf, pages[i].objptr));
     }
+    xfree(pages);
 }
 
 /*tex
@@ -2230,6 +2352,7 @@ void pdf_finish_file(PDF pdf, int fatal_error) {
                 pdf->gen_tounicode = pdf_gen_tounicode;
                 pdf->omit_cidset = pdf_omit_cidset;
                 pdf->omit_charset = pdf_omit_charset;
+                pdf->font_workers = pdf_font_workers;
                 k = pdf->head_tab[obj_type_font];
                 while (k != 0) {
                     int f = obj_info(pdf, k);
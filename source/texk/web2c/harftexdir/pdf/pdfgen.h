@@ -175,6 +175,10 @@ extern void strbuf_putchar(strbuf_s * b, unsigned char c);
 extern void strbuf_flush(PDF pdf, strbuf_s * b);
 extern void strbuf_free(strbuf_s * b);
 
+extern stream_capture *pdf_begin_capture(PDF pdf);
+extern void pdf_end_capture(PDF pdf);
+extern void pdf_free_capture(stream_capture * c);
+
 /* This is for the resource lists */
 
 extern void addto_page_resources(PDF pdf, pdf_obj_type t, int k);
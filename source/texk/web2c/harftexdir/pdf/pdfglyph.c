@@ -100,7 +100,8 @@ static void set_font(PDF pdf)
         pdf_puts(pdf, "0 Tr\n");
         p->done_mode = 0;
     }
-    pdf_printf(pdf, "/F%d", (int) p->f_pdf);
+    pdf_puts(pdf, "/F");
+    pdf_print_int(pdf, p->f_pdf);
     pdf_print_resname_prefix(pdf);
     pdf_out(pdf, ' ');
     print_pdffloat(pdf, p->fs);
@@ -35,86 +35,169 @@ int pdf_cur_form;
 
 /*tex
 
-    AVL sort entry into |avl_table[]|.
+    Objects that have an identifier (named or numbered destinations, threads,
+    pages, etc.) are found back via a hash map per object type. The maps are
+    only used for lookups; objects get their numbers when they are created so
+    the order of the output doesn't depend on them.
+
 */
 
-static int compare_info(const void *pa, const void *pb, void *param)
+#define obj_map_initial_size 64
+
+int obj_map_size = 0;
+int obj_map_entries = 0;
+int obj_map_lookups = 0;
+
+static unsigned hash_int_obj(int i)
 {
-    const oentry *a = (const oentry *) pa;
-    const oentry *b = (const oentry *) pb;
-    (void) param;
-    if (a->u_type == b->u_type) {
-        if (a->u_type == union_type_int) {
-            return ((a->u.int0 < b->u.int0 ? -1 : (a->u.int0 > b->u.int0 ? 1 : 0)));
-        } else {
-            /*tex String type: */
-            return strcmp(a->u.str0, b->u.str0);
-        }
-    } else if (a->u_type == union_type_int) {
-        return -1;
-    } else {
-        return 1;
+    unsigned h = (unsigned) i * 2654435761U;
+    return h ^ (h >> 15);
+}
+
+static unsigned hash_str_obj(const char *s)
+{
+    /*tex This is the FNV-1a hash. */
+    unsigned h = 2166136261U;
+    while (*s != '\0') {
+        h ^= (unsigned char) *s++;
+        h *= 16777619U;
     }
+    return h;
 }
 
-static void avl_put_obj(PDF pdf, int t, oentry * oe)
+static boolean same_obj(const oentry * a, const oentry * b)
 {
-    void **pp;
-    if (pdf->obj_tree[t] == NULL) {
-        pdf->obj_tree[t] = avl_create(compare_info, NULL, &avl_xallocator);
-        if (pdf->obj_tree[t] == NULL)
-            formatted_error("pdf backend","avl_create() pdf->obj_tree failed");
+    if (a->hash != b->hash || a->u_type != b->u_type)
+        return false;
+    if (a->u_type == union_type_int)
+        return a->u.int0 == b->u.int0;
+    return strcmp(a->u.str0, b->u.str0) == 0;
+}
+
+static oentry *obj_map_slot(obj_map * m, const oentry * oe)
+{
+    unsigned i = oe->hash & (m->size - 1);
+    while (m->slots[i].objptr != 0 && !same_obj(&m->slots[i], oe))
+        i = (i + 1) & (m->size - 1);
+    return &m->slots[i];
+}
+
+static void obj_map_grow(obj_map * m)
+{
+    unsigned i;
+    unsigned size = m->size;
+    oentry *slots = m->slots;
+    m->size = (size == 0) ? obj_map_initial_size : 2 * size;
+    m->slots = xcalloc(m->size, sizeof(oentry));
+    obj_map_size += (int) (m->size - size);
+    for (i = 0; i < size; i++) {
+        if (slots[i].objptr != 0)
+            *obj_map_slot(m, &slots[i]) = slots[i];
+    }
+    xfree(slots);
+}
+
+static void obj_map_put(PDF pdf, int t, oentry * oe)
+{
+    oentry *slot;
+    obj_map *m = pdf->obj_map[t];
+    if (m == NULL) {
+        m = pdf->obj_map[t] = xtalloc(1, obj_map);
+        memset(m, 0, sizeof(obj_map));
+    }
+    /*tex We keep the load factor below one half. */
+    if (2 * (m->count + 1) > m->size)
+        obj_map_grow(m);
+    slot = obj_map_slot(m, oe);
+    if (slot->objptr == 0) {
+        *slot = *oe;
+        m->count++;
+        obj_map_entries++;
+    } else if (oe->u_type == union_type_cstring) {
+        /*tex The first object with this name wins, as before. */
+        xfree(oe->u.str0);
     }
-    pp = avl_probe(pdf->obj_tree[t], oe);
-    if (pp == NULL)
-        formatted_error("pdf backend","avl_probe() out of memory in insertion");
 }
 
-static void avl_put_int_obj(PDF pdf, int int0, int objptr, int t)
+static int obj_map_find(PDF pdf, int t, oentry * oe)
 {
-    oentry *oe = xtalloc(1, oentry);
-    oe->u.int0 = int0;
-    oe->u_type = union_type_int;
-    oe->objptr = objptr;
-    avl_put_obj(pdf, t, oe);
+    obj_map *m = pdf->obj_map[t];
+    obj_map_lookups++;
+    if (m == NULL)
+        return 0;
+    return obj_map_slot(m, oe)->objptr;
+}
+
+static void put_int_obj(PDF pdf, int int0, int objptr, int t)
+{
+    oentry oe;
+    oe.u.int0 = int0;
+    oe.u_type = union_type_int;
+    oe.objptr = objptr;
+    oe.hash = hash_int_obj(int0);
+    obj_map_put(pdf, t, &oe);
 }
 
-static void avl_put_str_obj(PDF pdf, char *str0, int objptr, int t)
+static void put_str_obj(PDF pdf, char *str0, int objptr, int t)
 {
-    oentry *oe = xtalloc(1, oentry);
+    oentry oe;
     /*tex No |xstrdup| here! */
-    oe->u.str0 = str0;
-    oe->u_type = union_type_cstring;
-    oe->objptr = objptr;
-    avl_put_obj(pdf, t, oe);
+    oe.u.str0 = str0;
+    oe.u_type = union_type_cstring;
+    oe.objptr = objptr;
+    oe.hash = hash_str_obj(str0);
+    obj_map_put(pdf, t, &oe);
 }
 
-static int avl_find_int_obj(PDF pdf, int t, int i)
+static int find_int_obj(PDF pdf, int t, int i)
 {
-    oentry *p;
     oentry tmp;
     tmp.u.int0 = i;
     tmp.u_type = union_type_int;
-    if (pdf->obj_tree[t] == NULL)
-        return 0;
-    p = (oentry *) avl_find(pdf->obj_tree[t], &tmp);
-    if (p == NULL)
-        return 0;
-    return p->objptr;
+    tmp.hash = hash_int_obj(i);
+    return obj_map_find(pdf, t, &tmp);
 }
 
-static int avl_find_str_obj(PDF pdf, int t, char *s)
+static int find_str_obj(PDF pdf, int t, char *s)
 {
-    oentry *p;
     oentry tmp;
     tmp.u.str0 = s;
     tmp.u_type = union_type_cstring;
-    if (pdf->obj_tree[t] == NULL)
-        return 0;
-    p = (oentry *) avl_find(pdf->obj_tree[t], &tmp);
-    if (p == NULL)
-        return 0;
-    return p->objptr;
+    tmp.hash = hash_str_obj(s);
+    return obj_map_find(pdf, t, &tmp);
+}
+
+static int compare_int_obj(const void *pa, const void *pb)
+{
+    const oentry *a = (const oentry *) pa;
+    const oentry *b = (const oentry *) pb;
+    return (a->u.int0 < b->u.int0 ? -1 : (a->u.int0 > b->u.int0 ? 1 : 0));
+}
+
+/*tex
+
+    This returns the numbered objects of type |t| sorted by their identifier, for
+    the few places where order matters. The number of entries ends up in |n|.
+
+*/
+
+oentry *sorted_int_objs(PDF pdf, int t, int *n)
+{
+    unsigned i;
+    int k = 0;
+    oentry *list;
+    obj_map *m = pdf->obj_map[t];
+    *n = 0;
+    if (m == NULL || m->count == 0)
+        return NULL;
+    list = xtalloc(m->count, oentry);
+    for (i = 0; i < m->size; i++) {
+        if (m->slots[i].objptr != 0 && m->slots[i].u_type == union_type_int)
+            list[k++] = m->slots[i];
+    }
+    qsort(list, (size_t) k, sizeof(oentry), compare_int_obj);
+    *n = k;
+    return list;
 }
 
 /*tex Create an object with type |t| and identifier |i|: */
@@ -140,9 +223,9 @@ int pdf_create_obj(PDF pdf, int t, int i)
     obj_aux(pdf, pdf->obj_ptr) = 0;
     if (i < 0) {
         ss = makecstring(-i);
-        avl_put_str_obj(pdf, ss, pdf->obj_ptr, t);
+        put_str_obj(pdf, ss, pdf->obj_ptr, t);
     } else if (i > 0)
-        avl_put_int_obj(pdf, i, pdf->obj_ptr, t);
+        put_int_obj(pdf, i, pdf->obj_ptr, t);
     if (t <= HEAD_TAB_MAX) {
         obj_link(pdf, pdf->obj_ptr) = pdf->head_tab[t];
         pdf->head_tab[t] = pdf->obj_ptr;
@@ -158,10 +241,10 @@ int find_obj(PDF pdf, int t, int i, boolean byname)
     int ret;
     if (byname) {
         ss = makecstring(i);
-        ret = avl_find_str_obj(pdf, t, ss);
+        ret = find_str_obj(pdf, t, ss);
         free(ss);
     } else {
-        ret = avl_find_int_obj(pdf, t, i);
+        ret = find_int_obj(pdf, t, i);
     }
     return ret;
 }
@@ -35,8 +35,15 @@ typedef struct {
     } u;
     union_type u_type; /* integer or char * in union above */
     int objptr;
+    unsigned hash;
 } oentry;
 
+typedef struct obj_map_ {
+    oentry *slots;     /* open addressing, a zero |objptr| marks a free slot */
+    unsigned size;     /* always a power of two */
+    unsigned count;
+} obj_map;
+
 /*
 
 The cross-reference table |obj_tab| is an array of |obj_tab_size| of |obj_entry|.
@@ -104,6 +111,7 @@ depending on the object type; however it may be used as a counter as well.
 #  define by_one_bp ((double) 65536 * (double) 72.27 / 72)  /* number of sp per 1bp */
 
 extern int find_obj(PDF pdf, int t, int i, boolean byname);
+extern oentry *sorted_int_objs(PDF pdf, int t, int *n);
 extern void check_obj_exists(PDF pdf, int objnum);
 extern void check_obj_type(PDF pdf, int t, int objnum);
 extern int pdf_get_obj(PDF pdf, int t, int i, boolean byname);
@@ -141,6 +149,7 @@ typedef enum {
     c_pdf_omit_cidset,
     c_pdf_recompress,
     c_pdf_omit_charset,
+    c_pdf_font_workers,
 } pdf_backend_counters ;
 
 typedef enum {
@@ -168,6 +177,10 @@ extern int pdf_last_obj;
 extern int pdf_retval;
 extern int pdf_cur_form;
 
+extern int obj_map_size;
+extern int obj_map_entries;
+extern int obj_map_lookups;
+
 #  define pdf_compress_level            get_tex_extension_count_register(c_pdf_compress_level)
 #  define pdf_obj_compress_level        get_tex_extension_count_register(c_pdf_obj_compress_level)
 #  define pdf_decimal_digits            get_tex_extension_count_register(c_pdf_decimal_digits)
@@ -191,6 +204,7 @@ extern int pdf_cur_form;
 #  define pdf_omit_cidset               get_tex_extension_count_register(c_pdf_omit_cidset)
 #  define pdf_omit_charset              get_tex_extension_count_register(c_pdf_omit_charset)
 #  define pdf_recompress                get_tex_extension_count_register(c_pdf_recompress)
+#  define pdf_font_workers              get_tex_extension_count_register(c_pdf_font_workers)
 
 #  define pdf_h_origin                  get_tex_extension_dimen_register(d_pdf_h_origin)
 #  define pdf_v_origin                  get_tex_extension_dimen_register(d_pdf_v_origin)
@@ -215,6 +229,7 @@ extern int pdf_cur_form;
 #  define set_pdf_omit_charset(i)       set_tex_extension_count_register(c_pdf_omit_charset,i)
 #  define set_pdf_gen_tounicode(i)      set_tex_extension_count_register(c_pdf_gen_tounicode,i)
 #  define set_pdf_recompress(i)         set_tex_extension_count_register(c_pdf_recompress,i)
+#  define set_pdf_font_workers(i)       set_tex_extension_count_register(c_pdf_font_workers,i)
 
 #  define set_pdf_decimal_digits(i)     set_tex_extension_count_register(c_pdf_decimal_digits,i)
 #  define set_pdf_pk_resolution(i)      set_tex_extension_count_register(c_pdf_pk_resolution,i)
@@ -242,6 +242,21 @@ typedef struct strbuf_s_ {
     size_t limit;               /* maximum allowed PDF stream buffer size */
 } strbuf_s;
 
+/*
+    While capturing, the (possibly compressed) bytes of the streams written are
+    also collected, one after another, so that they can be reused later.
+*/
+
+#  define MAX_CAPTURED_STREAMS 4
+
+typedef struct stream_capture_ {
+    strbuf_s *data;             /* the bytes of all captured streams */
+    size_t lengths[MAX_CAPTURED_STREAMS];
+    int count;                  /* number of completed streams */
+    int capturing;              /* true while a stream is captured */
+    int overflow;               /* true when there were more streams than we can keep */
+} stream_capture;
+
 typedef struct os_struct_ {
     os_obj_data *obj;           /* array of object stream objects */
     strbuf_s *buf[3];
@@ -294,6 +309,7 @@ typedef struct pdf_output_file_ {
     int gen_tounicode;
     int omit_cidset;
     int omit_charset;
+    int font_workers;           /* threads used for compressing embedded font programs */
     int inclusion_copy_font;
     int major_version;          /* fixed major part of the PDF version */
     int minor_version;          /* fixed minor part of the PDF version */
@@ -322,6 +338,7 @@ typedef struct pdf_output_file_ {
     zip_write_state_e zip_write_state;  /* which state of compression we are in */
     int stream_deflate;         /* true, if stream dict has /Filter/FlateDecode */
     int stream_writing;         /* true while writing stream */
+    stream_capture *capture;    /* when set, stream data written to the file is also collected here */
 
     int pk_scale_factor;        /* this is just a preprocessed value that depends on |pk_resolution| and |decimal_digits| */
 
@@ -338,7 +355,7 @@ typedef struct pdf_output_file_ {
     int obj_tab_size;           /* allocated size of |obj_tab| array */
     obj_entry *obj_tab;
     int head_tab[HEAD_TAB_MAX + 1];     /* heads of the object lists in |obj_tab| */
-    struct avl_table *obj_tree[PDF_OBJ_TYPE_MAX + 1];   /* this is useful for finding the objects back */
+    struct obj_map_ *obj_map[PDF_OBJ_TYPE_MAX + 1];     /* this is useful for finding the objects back */
 
     int pages_tail;
     int obj_ptr;                /* objects counter */
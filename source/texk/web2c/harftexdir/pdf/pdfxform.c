@@ -106,7 +106,7 @@ void scan_pdfxform(PDF pdf)
     set_obj_xform_width(pdf, k, width(p));
     set_obj_xform_height(pdf, k, height(p));
     set_obj_xform_depth(pdf, k, depth(p));
-    box(cur_val) = null;
+    change_box(cur_val, null);
     last_saved_box_index = k;
 }
 
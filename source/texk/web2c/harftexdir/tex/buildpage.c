@@ -299,13 +299,14 @@ void start_new_page(void)
 
 static void box_error(int n)
 {
+    halfword p = box(n);
+    change_box(n, null);
     error();
     begin_diagnostic();
     tprint_nl("The following box has been deleted:");
-    show_box(box(n));
+    show_box(p);
     end_diagnostic(true);
-    flush_node_list(box(n));
-    box(n) = null;
+    flush_node_list(p);
 }
 
 /*tex
@@ -883,7 +884,10 @@ void fire_up(halfword c)
                 n = subtype(r);
                 ensure_vbox(n);
                 if (box(n) == null)
-                    box(n) = new_null_box();
+                    change_box(n, new_null_box());
+                else if (checkpointing)
+                    /*tex The box is extended in place below. */
+                    change_box(n, box(n));
                 p = box(n) + list_offset;
                 while (vlink(p) != null)
                     p = vlink(p);
@@ -950,10 +954,10 @@ void fire_up(halfword c)
                         }
                         best_ins_ptr(r) = null;
                         n = subtype(r);
-                        t = list_ptr(box(n));
-                        list_ptr(box(n)) = null;
-                        flush_node(box(n));
-                        box(n) = vpack(t, 0, additional, body_direction_par);
+                        t = box(n);
+                        change_box(n, vpack(list_ptr(t), 0, additional, body_direction_par));
+                        list_ptr(t) = null;
+                        flush_node(t);
 
                     } else {
                         while (vlink(s) != null)
@@ -1026,8 +1030,8 @@ void fire_up(halfword c)
     save_vfuzz = vfuzz_par;
     /*tex Inhibit error messages. */
     vfuzz_par = max_dimen;
-    box(output_box_par) = filtered_vpackage(vlink(page_head),
-        best_size, exactly, page_max_depth, output_group, body_direction_par, 0, 0);
+    change_box(output_box_par, filtered_vpackage(vlink(page_head),
+        best_size, exactly, page_max_depth, output_group, body_direction_par, 0, 0));
     vbadness_par = save_vbadness;
     vfuzz_par = save_vfuzz;
     if (last_glue != max_halfword)
@@ -1099,8 +1103,9 @@ void fire_up(halfword c)
     }
     flush_node_list(page_disc);
     page_disc = null;
-    ship_out(static_pdf, box(output_box_par), SHIPPING_PAGE);
-    box(output_box_par) = null;
+    p = box(output_box_par);
+    change_box(output_box_par, null);
+    ship_out(static_pdf, p, SHIPPING_PAGE);
 }
 
 /*tex
@@ -164,69 +164,27 @@ static boolean test_for_cs(void)
 {
     /*tex Is the condition true? */
     boolean b = false;
-    /*tex To be tested against the second operand: */
-    int m, s;
-    /*tex For traversing token lists in \.{\\ifx} tests: */
-    halfword q;
-    halfword n = get_avail();
-    /*tex Head of the list of characters: */
-    halfword p = n;
+    /*tex The offset and hash code of the name: */
+    int s;
+    halfword h;
     is_in_csname += 1;
-    while (1) {
-        get_x_token();
-        if (cur_cs != 0)
-            break;
-        store_new_token(cur_tok);
-    }
+    s = scan_csname(&h);
     if (cur_cmd != end_cs_name_cmd) {
         last_tested_cs = null_cs;
         if (suppress_ifcsname_error_par) {
             do {
                 get_x_token();
             } while (cur_cmd != end_cs_name_cmd);
-            flush_list(n);
+            flush_csname(s);
             is_in_csname -= 1;
             return b;
         } else {
             complain_missing_csname();
         }
     }
-    /*tex Look up the characters of list |n| in the hash table, and set |cur_cs|. */
-    m = first;
-    p = token_link(n);
-    while (p != null) {
-        if (m >= max_buf_stack) {
-            max_buf_stack = m + 4;
-            if (max_buf_stack >= buf_size)
-                check_buffer_overflow(max_buf_stack);
-        }
-        s = token_chr(token_info(p));
-        if (s <= 0x7F) {
-            buffer[m++] = (packed_ASCII_code) s;
-        } else if (s <= 0x7FF) {
-            buffer[m++] = (packed_ASCII_code) (0xC0 + s / 0x40);
-            buffer[m++] = (packed_ASCII_code) (0x80 + s % 0x40);
-        } else if (s <= 0xFFFF) {
-            buffer[m++] = (packed_ASCII_code) (0xE0 + s / 0x1000);
-            buffer[m++] = (packed_ASCII_code) (0x80 + (s % 0x1000) / 0x40);
-            buffer[m++] = (packed_ASCII_code) (0x80 + (s % 0x1000) % 0x40);
-        } else {
-            buffer[m++] = (packed_ASCII_code) (0xF0 + s / 0x40000);
-            buffer[m++] = (packed_ASCII_code) (0x80 + (s % 0x40000) / 0x1000);
-            buffer[m++] = (packed_ASCII_code) (0x80 + ((s % 0x40000) % 0x1000) / 0x40);
-            buffer[m++] = (packed_ASCII_code) (0x80 + ((s % 0x40000) % 0x1000) % 0x40);
-        }
-        p = token_link(p);
-    }
-    if (m > first) {
-        /*tex |no_new_control_sequence| is |true| */
-        cur_cs = id_lookup(first, m - first);
-    } else if (m == first) {
-        /*tex the list is empty */
-        cur_cs = null_cs;
-    }
+    /*tex Look up the characters in the hash table, and set |cur_cs|; |no_new_control_sequence| is |true|. */
+    cur_cs = csname_lookup(s, h);
     b = (eq_type(cur_cs) != undefined_cs_cmd);
-    flush_list(n);
     last_cs_name = cur_cs;
     is_in_csname -= 1;
     return b;
@@ -651,10 +651,17 @@ void eq_define(halfword p, quarterword t, halfword e)
     }
     if (trace)
         diagnostic_trace(p, "changing");
-    if (eq_level(p) == cur_level)
-        eq_destroy(eqtb[p]);
-    else if (cur_level > level_one)
-        eq_save(p, eq_level(p));
+    if (eq_level(p) == cur_level) {
+        if (checkpointing)
+            checkpoint_eqtb(p, true, true);
+        else
+            eq_destroy(eqtb[p]);
+    } else {
+        if (checkpointing)
+            checkpoint_eqtb(p, false, true);
+        if (cur_level > level_one)
+            eq_save(p, eq_level(p));
+    }
     set_eq_level(p, cur_level);
     set_eq_type(p, t);
     set_equiv(p, e);
@@ -680,6 +687,8 @@ void eq_word_define(halfword p, int w)
     }
     if (trace)
         diagnostic_trace(p, "changing");
+    if (checkpointing)
+        checkpoint_eqtb(p, false, false);
     if (xeq_level[p] != cur_level) {
         eq_save(p, xeq_level[p]);
         xeq_level[p] = cur_level;
@@ -703,7 +712,10 @@ void geq_define(halfword p, quarterword t, halfword e)
     boolean trace = tracing_assigns_par > 0;
     if (trace)
         diagnostic_trace(p, "globally changing");
-    eq_destroy(eqtb[p]);
+    if (checkpointing)
+        checkpoint_eqtb(p, true, true);
+    else
+        eq_destroy(eqtb[p]);
     set_eq_level(p, level_one);
     set_eq_type(p, t);
     set_equiv(p, e);
@@ -716,6 +728,8 @@ void geq_word_define(halfword p, int w)
     boolean trace = tracing_assigns_par > 0;
     if (trace)
         diagnostic_trace(p, "globally changing");
+    if (checkpointing)
+        checkpoint_eqtb(p, false, false);
     eqtb[p].cint = w;
     xeq_level[p] = level_one;
     if (trace)
@@ -788,18 +802,26 @@ void unsave(void)
                 if (p < int_base || p > eqtb_size) {
                     if (eq_level(p) == level_one) {
                         /*tex Destroy the saved value: */
-                        eq_destroy(save_word(save_ptr));
+                        if (checkpointing)
+                            checkpoint_keep(save_word(save_ptr));
+                        else
+                            eq_destroy(save_word(save_ptr));
                         if (trace)
                             diagnostic_trace(p, "retaining");
                     } else {
                         /*tex Destroy the current value: */
-                        eq_destroy(eqtb[p]);
+                        if (checkpointing)
+                            checkpoint_eqtb(p, true, false);
+                        else
+                            eq_destroy(eqtb[p]);
                         /*tex Restore the saved value: */
                         eqtb[p] = save_word(save_ptr);
                         if (trace)
                             diagnostic_trace(p, "restoring");
                     }
                 } else if (xeq_level[p] != level_one) {
+                    if (checkpointing)
+                        checkpoint_eqtb(p, false, false);
                     eqtb[p] = save_word(save_ptr);
                     xeq_level[p] = l;
                     if (trace)
@@ -821,6 +843,8 @@ void unsave(void)
         cur_group = save_level(save_ptr);
         cur_boundary = save_value(save_ptr);
         decr(save_ptr);
+        if (checkpointing)
+            checkpoint_end_group();
     } else {
         /*tex |unsave| is not used when |cur_group=bottom_level| */
         confusion("curlevel");
@@ -830,6 +854,289 @@ void unsave(void)
 
 /*tex
 
+A checkpoint makes it possible to typeset something on trial and then either keep
+the result or undo all assignments made in the meantime. While at least one
+checkpoint is active every change of |eqtb| and of the sparse arrays that behave
+like it (catcodes, lccodes, mathcodes, etc.) is recorded in a journal, so that
+both committing and rolling back take time proportional to the number of changes.
+
+Values that would have been destroyed by an assignment or by |unsave| are kept
+alive by the journal instead (they are |owned|). When we roll back the entries
+are undone in reverse order: a value that came from the save stack goes back to
+|eqtb| and the value that replaced it is destroyed if |eqtb| owned it (|drop|).
+Because a rollback is only permitted at the group level where the checkpoint was
+made, all groups opened in the meantime have been closed and the save stack can
+simply be cut back. When a group that holds a checkpoint ends, the checkpoint is
+committed.
+
+The current list is restored too: nodes appended after the checkpoint are
+flushed. We don't touch other state like fonts, marks, the page builder, files or
+\LUA\ variables.
+
+*/
+
+typedef enum {
+    checkpoint_eqtb_entry,
+    checkpoint_eqtb_keep,
+    checkpoint_sa_entry,
+    checkpoint_sa_push_entry,
+    checkpoint_sa_skip_entry,
+} checkpoint_entry_types;
+
+typedef struct checkpoint_entry {
+    int type;
+    int index;
+    quarterword level;
+    boolean owned;
+    boolean drop;
+    memory_word word;
+    sa_tree head;
+    sa_tree_item value;
+} checkpoint_entry;
+
+typedef struct checkpoint_record {
+    int journal_ptr;
+    quarterword level;
+    int boundary;
+    int save_ptr;
+    int nest_ptr;
+    halfword head;
+    halfword tail;
+    boolean tail_removed;
+    int pg;
+    halfword prev_depth;
+    halfword space_factor;
+} checkpoint_record;
+
+int checkpoint_ptr = 0;
+
+static checkpoint_record *checkpoints = NULL;
+static int checkpoint_size = 0;
+
+static checkpoint_entry *journal = NULL;
+static int journal_ptr = 0;
+static int journal_size = 0;
+
+static checkpoint_entry *new_journal_entry(int type)
+{
+    checkpoint_entry *e;
+    if (journal_ptr == journal_size) {
+        journal_size = journal_size + 1024;
+        journal = xrealloc(journal, (unsigned) (journal_size * sizeof(checkpoint_entry)));
+    }
+    e = &journal[journal_ptr++];
+    e->type = type;
+    e->owned = false;
+    e->drop = false;
+    e->head = NULL;
+    return e;
+}
+
+void checkpoint_eqtb(halfword p, boolean owned, boolean drop)
+{
+    checkpoint_entry *e = new_journal_entry(checkpoint_eqtb_entry);
+    e->index = p;
+    e->word = eqtb[p];
+    e->owned = owned;
+    e->drop = drop;
+    if (p >= int_base && p <= eqtb_size)
+        e->level = xeq_level[p];
+}
+
+void checkpoint_keep(memory_word w)
+{
+    checkpoint_entry *e = new_journal_entry(checkpoint_eqtb_keep);
+    e->word = w;
+    e->owned = true;
+}
+
+void checkpoint_sa_value(sa_tree head, int n, sa_tree_item v)
+{
+    checkpoint_entry *e = new_journal_entry(checkpoint_sa_entry);
+    e->head = head;
+    e->index = n;
+    e->value = v;
+}
+
+void checkpoint_sa_push(sa_tree head)
+{
+    checkpoint_entry *e = new_journal_entry(checkpoint_sa_push_entry);
+    e->head = head;
+    e->index = head->stack_ptr;
+}
+
+void checkpoint_sa_skip(sa_tree head, int i)
+{
+    checkpoint_entry *e = new_journal_entry(checkpoint_sa_skip_entry);
+    e->head = head;
+    e->index = i;
+}
+
+/*tex
+
+Box registers are also emptied without |eq_define|, for instance by \.{\box},
+\.{\unhbox} and \.{\vsplit}. The material then moves elsewhere and can be
+destroyed there, so the journal keeps a copy of the box that it owns.
+
+*/
+
+void change_box(halfword n, halfword p)
+{
+    if (checkpointing) {
+        checkpoint_entry *e = new_journal_entry(checkpoint_eqtb_entry);
+        e->index = box_base + n;
+        e->word = eqtb[box_base + n];
+        equiv_field(e->word) = copy_node_list(box(n));
+        e->owned = true;
+        e->drop = true;
+    }
+    box(n) = p;
+}
+
+/*tex
+
+A rollback cuts the current list after the tail that was current when the
+checkpoint was made. When that node is removed (\.{\unskip}, \.{\lastbox})
+its memory can be reused, so we remember that it is gone.
+
+*/
+
+void checkpoint_forget_node(halfword p)
+{
+    int i;
+    for (i = 0; i < checkpoint_ptr; i++) {
+        if (checkpoints[i].tail == p)
+            checkpoints[i].tail_removed = true;
+    }
+}
+
+/*tex A sparse array can go away, for instance when a catcode table is replaced. */
+
+void checkpoint_sa_forget(sa_tree head)
+{
+    int i;
+    for (i = 0; i < journal_ptr; i++) {
+        if (journal[i].head == head)
+            journal[i].head = NULL;
+    }
+}
+
+int new_checkpoint(void)
+{
+    checkpoint_record *c;
+    if (checkpoint_ptr == checkpoint_size) {
+        checkpoint_size = checkpoint_size + 16;
+        checkpoints = xrealloc(checkpoints, (unsigned) (checkpoint_size * sizeof(checkpoint_record)));
+    }
+    c = &checkpoints[checkpoint_ptr++];
+    c->journal_ptr = journal_ptr;
+    c->level = cur_level;
+    c->boundary = cur_boundary;
+    c->save_ptr = save_ptr;
+    c->nest_ptr = nest_ptr;
+    c->head = cur_list.head_field;
+    c->tail = cur_list.tail_field;
+    c->tail_removed = false;
+    c->pg = cur_list.pg_field;
+    c->prev_depth = cur_list.prev_depth_field;
+    c->space_factor = cur_list.space_factor_field;
+    return checkpoint_ptr;
+}
+
+/*tex
+
+Committing a nested checkpoint keeps its entries for the enclosing one, only when
+the outermost one is committed the values kept alive are released.
+
+*/
+
+boolean commit_checkpoint(int n)
+{
+    int i;
+    if (n < 1 || n > checkpoint_ptr)
+        return false;
+    checkpoint_ptr = n - 1;
+    if (checkpoint_ptr == 0) {
+        for (i = 0; i < journal_ptr; i++) {
+            if (journal[i].owned)
+                eq_destroy(journal[i].word);
+        }
+        journal_ptr = 0;
+    }
+    return true;
+}
+
+void checkpoint_end_group(void)
+{
+    while (checkpoint_ptr > 0 && checkpoints[checkpoint_ptr - 1].level > cur_level) {
+        commit_checkpoint(checkpoint_ptr);
+    }
+}
+
+int rollback_checkpoint(int n)
+{
+    checkpoint_record *c;
+    halfword p;
+    if (n < 1 || n > checkpoint_ptr)
+        return checkpoint_unknown;
+    c = &checkpoints[n - 1];
+    if (c->level != cur_level || c->boundary != cur_boundary || c->save_ptr > save_ptr)
+        return checkpoint_wrong_group;
+    if (c->nest_ptr != nest_ptr || c->head != cur_list.head_field || c->tail_removed)
+        return checkpoint_wrong_list;
+    p = c->head;
+    while (p != c->tail && p != null)
+        p = vlink(p);
+    if (p != c->tail)
+        return checkpoint_wrong_list;
+    /*tex Undoing must not be journaled itself. */
+    checkpoint_ptr = 0;
+    while (journal_ptr > c->journal_ptr) {
+        checkpoint_entry *e = &journal[--journal_ptr];
+        switch (e->type) {
+            case checkpoint_eqtb_entry:
+                if (e->index < int_base || e->index > eqtb_size) {
+                    if (e->drop)
+                        eq_destroy(eqtb[e->index]);
+                } else {
+                    xeq_level[e->index] = e->level;
+                }
+                eqtb[e->index] = e->word;
+                break;
+            case checkpoint_sa_entry:
+                if (e->head != NULL)
+                    rawset_sa_item(e->head, e->index, e->value);
+                break;
+            case checkpoint_sa_push_entry:
+                if (e->head != NULL)
+                    e->head->stack_ptr = e->index;
+                break;
+            case checkpoint_sa_skip_entry:
+                if (e->head != NULL)
+                    e->head->stack[e->index].level = abs(e->head->stack[e->index].level);
+                break;
+            default:
+                /*tex A kept value goes back to the (now gone) save stack. */
+                break;
+        }
+    }
+    /*tex Whatever was saved since is undone by now. */
+    save_ptr = c->save_ptr;
+    if (vlink(c->tail) != null) {
+        flush_node_list(vlink(c->tail));
+        vlink(c->tail) = null;
+    }
+    cur_list.tail_field = c->tail;
+    cur_list.pg_field = c->pg;
+    cur_list.prev_depth_field = c->prev_depth;
+    cur_list.space_factor_field = c->space_factor;
+    checkpoint_ptr = n - 1;
+    attr_list_cache = cache_disabled;
+    return checkpoint_done;
+}
+
+/*tex
+
 Most of the parameters kept in |eqtb| can be changed freely, but there's an
 exception: The magnification should not be used with two different values during
 any \TeX\ job, since a single magnification is applied to an entire run. The
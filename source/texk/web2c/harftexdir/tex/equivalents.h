@@ -559,6 +559,34 @@ extern void save_for_after(halfword t);
 extern void unsave(void);                                       /* pops the top level off the save stack */
 extern void show_save_groups(void);
 
+/* checkpoints: an undo journal of |eqtb| and |sa_tree| changes */
+
+extern int checkpoint_ptr;                                      /* number of active checkpoints */
+
+#  define checkpointing (checkpoint_ptr > 0)
+
+extern int new_checkpoint(void);
+extern boolean commit_checkpoint(int n);
+extern int rollback_checkpoint(int n);
+extern void checkpoint_end_group(void);
+
+extern void checkpoint_eqtb(halfword p, boolean owned, boolean drop);
+extern void checkpoint_keep(memory_word w);
+extern void checkpoint_sa_value(sa_tree head, int n, sa_tree_item v);
+extern void checkpoint_sa_push(sa_tree head);
+extern void checkpoint_sa_skip(sa_tree head, int i);
+extern void checkpoint_sa_forget(sa_tree head);
+extern void checkpoint_forget_node(halfword p);
+
+extern void change_box(halfword n, halfword p);                /* sets a box register outside |eq_define| */
+
+typedef enum {
+    checkpoint_done = 0,
+    checkpoint_unknown,
+    checkpoint_wrong_group,
+    checkpoint_wrong_list,
+} checkpoint_states;
+
 #  define level_zero 0                                          /* level for undefined quantities */
 #  define level_one 1                                           /* outermost level for defined quantities */
 
@@ -393,34 +393,100 @@ void complain_missing_csname(void)
     back_error();
 }
 
+/*tex
+
+    The characters of a name are collected as \UTF-8 in |csname_buffer| while
+    its hash code is computed, so no token list or string has to be made. The
+    expansion of one name can scan another one; that name is put on top of the
+    first one and removed when it has been looked up, which is why names are
+    identified by their offset in the buffer.
+
+*/
+
+static unsigned char *csname_buffer = NULL;
+static int csname_size = 0;
+static int csname_top = 0;
+
+#define add_csname_byte(b) do {              \
+    csname_buffer[csname_top++] = (unsigned char) (b); \
+    hash_add_byte(*h, b);                    \
+} while (0)
+
+static void add_csname_char(int c, halfword * h)
+{
+    if (csname_top + 4 > csname_size) {
+        csname_size = csname_size == 0 ? 256 : 2 * csname_size;
+        csname_buffer = xrealloc(csname_buffer, (unsigned) csname_size);
+    }
+    if (c <= 0x7F) {
+        add_csname_byte(c);
+    } else if (c <= 0x7FF) {
+        add_csname_byte(0xC0 + c / 0x40);
+        add_csname_byte(0x80 + c % 0x40);
+    } else if (c <= 0xFFFF) {
+        add_csname_byte(0xE0 + c / 0x1000);
+        add_csname_byte(0x80 + (c % 0x1000) / 0x40);
+        add_csname_byte(0x80 + (c % 0x1000) % 0x40);
+    } else {
+        add_csname_byte(0xF0 + c / 0x40000);
+        add_csname_byte(0x80 + (c % 0x40000) / 0x1000);
+        add_csname_byte(0x80 + ((c % 0x40000) % 0x1000) / 0x40);
+        add_csname_byte(0x80 + ((c % 0x40000) % 0x1000) % 0x40);
+    }
+}
+
+/*tex
+
+    This scans expanded characters up to the first control sequence, which is
+    left in |cur_cmd|, and returns the offset of the name.
+
+*/
+
+int scan_csname(halfword * h)
+{
+    int s = csname_top;
+    *h = 0;
+    while (1) {
+        get_x_token();
+        if (cur_cs != 0)
+            break;
+        add_csname_char(cur_chr, h);
+    }
+    return s;
+}
+
+/*tex This looks up the name at offset |s| with hash code |h| and removes it. */
+
+halfword csname_lookup(int s, halfword h)
+{
+    halfword p = null_cs;
+    if (csname_top > s) {
+        p = hashed_string_lookup((const char *) (csname_buffer + s), (size_t) (csname_top - s), h);
+    }
+    csname_top = s;
+    return p;
+}
+
+void flush_csname(int s)
+{
+    csname_top = s;
+}
+
 void manufacture_csname(boolean use)
 {
-    halfword p, q, r;
-    lstring *ss;
-    r = get_avail();
-    p = r;
+    halfword h;
+    int s;
     is_in_csname += 1;
-    do {
-        get_x_token();
-        if (cur_cs == 0)
-            store_new_token(cur_tok);
-    } while (cur_cs == 0);
+    s = scan_csname(&h);
     if (cur_cmd != end_cs_name_cmd) {
         /*tex Complain about missing \.{\\endcsname}. */
         complain_missing_csname();
     }
-    /*tex Look up the characters of list |r| in the hash table, and set |cur_cs|. */
-    ss = tokenlist_to_lstring(r, true);
     is_in_csname -= 1;
+    /*tex Look up the characters in the hash table, and set |cur_cs|. */
     if (use) {
-        if (ss->l > 0) {
-            cur_cs = string_lookup((char *) ss->s, ss->l);
-        } else {
-            cur_cs = null_cs;
-        }
+        cur_cs = csname_lookup(s, h);
         last_cs_name = cur_cs ;
-        free_lstring(ss);
-        flush_list(r);
         if (cur_cs == null_cs) {
             /*tex skip */
         } else if (eq_type(cur_cs) == undefined_cs_cmd) {
@@ -430,17 +496,11 @@ void manufacture_csname(boolean use)
             back_input();
         }
     } else {
-        if (ss->l > 0) {
-            no_new_control_sequence = false;
-            cur_cs = string_lookup((char *) ss->s, ss->l);
-            no_new_control_sequence = true;
-        } else {
-            /*tex the list is empty */
-            cur_cs = null_cs;
-        }
+        /*tex An empty name gives |null_cs|. */
+        no_new_control_sequence = false;
+        cur_cs = csname_lookup(s, h);
+        no_new_control_sequence = true;
         last_cs_name = cur_cs ;
-        free_lstring(ss);
-        flush_list(r);
         if (eq_type(cur_cs) == undefined_cs_cmd) {
             /*tex The |save_stack| might change! */
             eq_define(cur_cs, relax_cmd, too_big_char);
@@ -926,6 +986,8 @@ void macro_call(void)
     }
     begin_token_list(ref_count, macro);
     iname = warning_index;
+    if (macro_profiling)
+        macro_profile_begin(warning_index);
     iloc = token_link(r);
     if (n > 0) {
         if (param_ptr + n > max_param_stack) {
@@ -965,3 +1027,166 @@ void macro_call(void)
     scanner_status = save_scanner_status;
     warning_index = save_warning_index;
 }
+
+/*tex
+
+    When macro profiling is enabled every call of a macro is counted, keyed by
+    the control sequence that was expanded. We also keep track of the number of
+    tokens fetched by |get_next|: tokens taken from the body of a macro are
+    attributed to that macro (its exclusive count) and all tokens fetched while
+    its body is on the input stack, including those of nested macros and files,
+    are added to its inclusive count. Optionally the wall time between pushing
+    and popping the body is accumulated too.
+
+    Because a body that has been read completely is popped before a macro at its
+    end is expanded, tail recursive macros are not nested. Real recursion counts
+    the inner calls in the inclusive numbers of every outer call.
+
+*/
+
+int macro_profiling = 0;
+int macro_profile_timing = 0;
+long macro_profile_fetches = 0;
+
+macro_profile_entry *macro_profile_data = NULL;
+int macro_profile_used = 0;
+
+static int macro_profile_size = 0;
+static int *macro_profile_slots = NULL;
+
+typedef struct macro_profile_mark {
+    int entry;
+    int seconds;
+    int micros;
+    long fetches;
+} macro_profile_mark;
+
+/*tex One per input level, |entry| is zero when no profiled macro started there. */
+
+static macro_profile_mark *macro_profile_marks = NULL;
+
+void macro_profile_enable(int on, int timing)
+{
+    if (on && ! macro_profiling) {
+        if (macro_profile_slots == NULL) {
+            macro_profile_slots = xcalloc((unsigned) (eqtb_top + 1), sizeof(int));
+            macro_profile_marks = xmalloc((unsigned) ((stack_size + 1) * sizeof(macro_profile_mark)));
+        }
+        memset(macro_profile_marks, 0, (size_t) (stack_size + 1) * sizeof(macro_profile_mark));
+    }
+    macro_profiling = on;
+    macro_profile_timing = on && timing;
+}
+
+void macro_profile_begin(halfword cs)
+{
+    int e;
+    macro_profile_mark *m = &macro_profile_marks[input_ptr];
+    if (cs < 0 || cs > eqtb_top)
+        return;
+    e = macro_profile_slots[cs];
+    if (e == 0) {
+        /*tex Slot zero is never used so that it can flag an unknown macro. */
+        if (macro_profile_used == 0)
+            macro_profile_used = 1;
+        if (macro_profile_used >= macro_profile_size) {
+            macro_profile_size = macro_profile_size + 256;
+            macro_profile_data = xrealloc(macro_profile_data, (unsigned) (macro_profile_size * sizeof(macro_profile_entry)));
+        }
+        e = macro_profile_used++;
+        memset(&macro_profile_data[e], 0, sizeof(macro_profile_entry));
+        macro_profile_data[e].cs = cs;
+        macro_profile_slots[cs] = e;
+    }
+    macro_profile_data[e].count++;
+    m->entry = e;
+    m->fetches = macro_profile_fetches;
+    if (macro_profile_timing)
+        get_seconds_and_micros(&m->seconds, &m->micros);
+}
+
+void macro_profile_end(void)
+{
+    macro_profile_mark *m = &macro_profile_marks[input_ptr];
+    if (m->entry > 0) {
+        macro_profile_entry *e = &macro_profile_data[m->entry];
+        e->inclusive += macro_profile_fetches - m->fetches;
+        if (macro_profile_timing) {
+            int seconds, micros;
+            get_seconds_and_micros(&seconds, &micros);
+            e->time += (seconds - m->seconds) + (micros - m->micros) / 1000000.0;
+        }
+        m->entry = 0;
+    }
+}
+
+void macro_profile_token(void)
+{
+    macro_profile_fetches++;
+    if (istate == token_list && token_type == macro) {
+        int e = macro_profile_marks[input_ptr].entry;
+        if (e > 0)
+            macro_profile_data[e].exclusive++;
+    }
+}
+
+/*tex
+
+    Names are written the way |print_cs| does, so an active character is just
+    the character and other control sequences get a backslash (whatever the
+    current \type {\escapechar}). This keeps \type {~} and \type {\~} apart. The
+    result has to be freed by the caller.
+
+*/
+
+char *macro_profile_name(halfword cs)
+{
+    char *s, *r;
+    if (cs == null_cs)
+        return xstrdup("\\csname\\endcsname");
+    else if (cs_text(cs) <= 0 || cs_text(cs) >= str_ptr)
+        return xstrdup("");
+    s = makecstring(cs_text(cs));
+    if (is_active_cs(cs_text(cs))) {
+        memmove(s, s + 3, strlen(s + 3) + 1);
+        return s;
+    }
+    r = xmalloc((unsigned) (strlen(s) + 2));
+    r[0] = '\\';
+    strcpy(r + 1, s);
+    free(s);
+    return r;
+}
+
+static int macro_profile_compare(const void *a, const void *b)
+{
+    long x = macro_profile_data[*(const int *) a].inclusive;
+    long y = macro_profile_data[*(const int *) b].inclusive;
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+/*tex Only the most expensive macros end up in the log. */
+
+#define macro_profile_report_max 100
+
+void macro_profile_report(FILE * f)
+{
+    int i, n = macro_profile_used - 1;
+    int *order;
+    if (n <= 0)
+        return;
+    order = xmalloc((unsigned) (n * sizeof(int)));
+    for (i = 0; i < n; i++)
+        order[i] = i + 1;
+    qsort(order, (size_t) n, sizeof(int), macro_profile_compare);
+    fprintf(f, "\nMacro expansion profile (calls, inclusive tokens, exclusive tokens, seconds):\n");
+    for (i = 0; i < n && i < macro_profile_report_max; i++) {
+        macro_profile_entry *e = &macro_profile_data[order[i]];
+        char *s = macro_profile_name(e->cs);
+        fprintf(f, " %s: %d, %ld, %ld, %.6f\n", s, e->count, e->inclusive, e->exclusive, e->time);
+        free(s);
+    }
+    if (n > macro_profile_report_max)
+        fprintf(f, " (%d more macros)\n", n - macro_profile_report_max);
+    free(order);
+}
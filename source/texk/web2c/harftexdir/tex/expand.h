@@ -25,6 +25,9 @@ extern boolean is_in_csname;
 extern void expand(void);
 extern void complain_missing_csname(void);
 extern void manufacture_csname(boolean use);
+extern int scan_csname(halfword * h);
+extern halfword csname_lookup(int s, halfword h);
+extern void flush_csname(int s);
 extern void inject_last_tested_cs(void);
 extern void insert_relax(void);
 extern void get_x_token(void);
@@ -98,5 +101,26 @@ extern int long_state;
 extern halfword pstack[9];
 extern void macro_call(void);
 
+typedef struct macro_profile_entry {
+    halfword cs;
+    int count;
+    long inclusive;
+    long exclusive;
+    double time;
+} macro_profile_entry;
+
+extern int macro_profiling;
+extern int macro_profile_timing;
+extern long macro_profile_fetches;
+extern macro_profile_entry *macro_profile_data;
+extern int macro_profile_used;
+
+extern void macro_profile_enable(int on, int timing);
+extern void macro_profile_begin(halfword cs);
+extern void macro_profile_end(void);
+extern void macro_profile_token(void);
+extern char *macro_profile_name(halfword cs);
+extern void macro_profile_report(FILE * f);
+
 
 #endif
@@ -561,6 +561,8 @@ void end_token_list(void)
             /*tex Update the reference count: */
             delete_token_ref(istart);
             if (token_type == macro) {
+                if (macro_profiling)
+                    macro_profile_end();
                 /*tex Parameters must be flushed: */
                 while (param_ptr > param_start) {
                     decr(param_ptr);
@@ -546,6 +546,21 @@ void main_body(void)
         while ((iloc < ilimit) && (buffer[iloc] == ' '))
             incr(iloc);
     }
+    if (fork_server()) {
+        /*tex
+            We are a job forked off a server, so we start over with the command
+            line of the client. The format is already there.
+        */
+        initialize_inputstack();
+        if (buffer[iloc] == '*')
+            incr(iloc);
+        if (buffer[iloc] == '&') {
+            while ((iloc < ilimit) && (buffer[iloc] != ' '))
+                incr(iloc);
+            while ((iloc < ilimit) && (buffer[iloc] == ' '))
+                incr(iloc);
+        }
+    }
     if (output_mode_option != 0)
         output_mode_par = output_mode_value;
     if (draft_mode_option != 0) {
@@ -646,6 +661,10 @@ void close_files_and_terminate(void)
             }
         }
     }
+    if (log_opened_global) {
+        callback_profile_report(log_file);
+        macro_profile_report(log_file);
+    }
     wake_up_terminal();
     /*tex
         Rubish, these \PDF arguments, passed, needs to be fixed, e.g. with a
@@ -2037,8 +2037,8 @@ void unpackage(void)
         s = copy_node_list(list_ptr(p));
         try_couple_nodes(tail,s);
     } else {
+        change_box(cur_val, null);
         try_couple_nodes(tail,list_ptr(p));
-        box(cur_val) = null;
         list_ptr(p) = null;
         flush_node(p);
     }
@@ -2666,6 +2666,7 @@ void prefixed_command(void)
                 set_token_link(q, token_link(def_ref));
                 set_token_link(def_ref, q);
             }
+            def_ref = pack_token_list(def_ref);
             define(p, call_cmd + (a % 4), def_ref);
             break;
         case let_cmd:
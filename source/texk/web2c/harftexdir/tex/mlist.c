@@ -1834,6 +1834,270 @@ static void math_kern(pointer p, scaled m)
     }
 }
 
+/*tex
+
+    Small formulas like $x$ or $i=1$ are converted over and over again. When the
+    cache is enabled we describe a formula by a sequence of numbers: the
+    structure of the noad list with characters, options and attributes, the
+    style, the current attributes and the parameters that influence the result,
+    including a signature of the current math families and parameters. When an identical description was seen before we flush the
+    noads and return a copy of the hlist made back then. Only lists made of
+    simple noads, characters, sub lists, glue, kerns, penalties and style
+    changes are cached; anything else (fractions, radicals, boxes, etc.) is
+    converted as usual. Formulas that carry the opt-out attribute are never
+    cached.
+
+*/
+
+#define math_cache_buckets 1024
+#define math_cache_max     4096
+
+typedef struct math_cache_entry {
+    unsigned int hash;
+    int length;
+    int *key;
+    halfword hlist;
+    struct math_cache_entry *next;
+} math_cache_entry;
+
+int math_cache_enabled = 0;
+int math_cache_attribute = -1;
+int math_cache_hits = 0;
+int math_cache_misses = 0;
+int math_cache_skipped = 0;
+int math_cache_entries = 0;
+
+static math_cache_entry **math_cache = NULL;
+
+static int *math_key = NULL;
+static int math_key_ptr = 0;
+static int math_key_size = 0;
+
+static void add_math_key(int v)
+{
+    if (math_key_ptr == math_key_size) {
+        math_key_size = math_key_size + 256;
+        math_key = xrealloc(math_key, (unsigned) (math_key_size * sizeof(int)));
+    }
+    math_key[math_key_ptr++] = v;
+}
+
+static void flush_math_cache(void)
+{
+    int i;
+    if (math_cache == NULL)
+        return;
+    for (i = 0; i < math_cache_buckets; i++) {
+        math_cache_entry *e = math_cache[i];
+        while (e != NULL) {
+            math_cache_entry *n = e->next;
+            flush_node_list(e->hlist);
+            xfree(e->key);
+            xfree(e);
+            e = n;
+        }
+        math_cache[i] = NULL;
+    }
+    math_cache_entries = 0;
+}
+
+void math_cache_enable(int enable, int attribute)
+{
+    if (! enable) {
+        flush_math_cache();
+    } else if (math_cache == NULL) {
+        math_cache = xcalloc(math_cache_buckets, sizeof(math_cache_entry *));
+    }
+    math_cache_enabled = enable;
+    math_cache_attribute = attribute;
+}
+
+/*tex Returns |false| when the attribute list has the opt-out attribute set. */
+
+static boolean add_math_key_attributes(halfword a)
+{
+    add_math_key(-1);
+    if (a != null && a != cache_disabled) {
+        a = vlink(a);
+        while (a != null) {
+            if (attribute_id(a) == math_cache_attribute && attribute_value(a) != UNUSED_ATTRIBUTE)
+                return false;
+            add_math_key(attribute_id(a));
+            add_math_key(attribute_value(a));
+            a = vlink(a);
+        }
+    }
+    return true;
+}
+
+static boolean add_math_key_kernel(halfword p);
+
+static boolean add_math_key_list(halfword p)
+{
+    while (p != null) {
+        add_math_key(type(p));
+        add_math_key(subtype(p));
+        if (! add_math_key_attributes(node_attr(p)))
+            return false;
+        switch (type(p)) {
+            case simple_noad:
+                add_math_key(noadoptions(p));
+                add_math_key(noadextra1(p));
+                add_math_key(noadextra3(p));
+                add_math_key(noadextra4(p));
+                if (! (add_math_key_kernel(nucleus(p)) && add_math_key_kernel(supscr(p)) && add_math_key_kernel(subscr(p))))
+                    return false;
+                break;
+            case glue_node:
+                if (leader_ptr(p) != null)
+                    return false;
+                add_math_key(width(p));
+                add_math_key(stretch(p));
+                add_math_key(shrink(p));
+                add_math_key(stretch_order(p));
+                add_math_key(shrink_order(p));
+                break;
+            case kern_node:
+                add_math_key(width(p));
+                break;
+            case penalty_node:
+                add_math_key(penalty(p));
+                break;
+            case style_node:
+                break;
+            default:
+                return false;
+        }
+        p = vlink(p);
+    }
+    add_math_key(-2);
+    return true;
+}
+
+static boolean add_math_key_kernel(halfword p)
+{
+    if (p == null) {
+        add_math_key(-3);
+        return true;
+    }
+    add_math_key(type(p));
+    add_math_key(subtype(p));
+    if (! add_math_key_attributes(node_attr(p)))
+        return false;
+    switch (type(p)) {
+        case math_char_node:
+        case math_text_char_node:
+            add_math_key(math_fam(p));
+            add_math_key(math_character(p));
+            return true;
+        case sub_mlist_node:
+            return add_math_key_list(math_list(p));
+        default:
+            return false;
+    }
+}
+
+static boolean make_math_key(halfword p, boolean penalties, int mstyle)
+{
+    int i;
+    uint64_t signature;
+    math_key_ptr = 0;
+    add_math_key(mstyle);
+    add_math_key(penalties);
+    signature = math_data_signature();
+    add_math_key((int) (signature >> 32));
+    add_math_key((int) (signature & 0xFFFFFFFF));
+    add_math_key(math_direction_par);
+    add_math_key(math_old_par);
+    add_math_key(math_rule_thickness_mode_par);
+    add_math_key(math_rules_mode_par);
+    add_math_key(math_rules_fam_par);
+    add_math_key(math_scripts_mode_par);
+    add_math_key(math_script_box_mode_par);
+    add_math_key(math_script_char_mode_par);
+    add_math_key(math_penalties_mode_par);
+    add_math_key(math_nolimits_mode_par);
+    add_math_key(math_italics_mode_par);
+    add_math_key(disable_lig_par);
+    add_math_key(disable_kern_par);
+    add_math_key(delimiter_factor_par);
+    add_math_key(delimiter_shortfall_par);
+    add_math_key(null_delimiter_space_par);
+    add_math_key(bin_op_penalty_par);
+    add_math_key(rel_penalty_par);
+    add_math_key(pre_bin_op_penalty_par);
+    add_math_key(pre_rel_penalty_par);
+    for (i = thin_mu_skip_code; i <= thick_mu_skip_code; i++) {
+        add_math_key(width(glue_par(i)));
+        add_math_key(stretch(glue_par(i)));
+        add_math_key(shrink(glue_par(i)));
+        add_math_key(stretch_order(glue_par(i)));
+        add_math_key(shrink_order(glue_par(i)));
+    }
+    if (! add_math_key_attributes(current_attribute_list()))
+        return false;
+    return add_math_key_list(p);
+}
+
+static unsigned int math_key_hash(void)
+{
+    unsigned int h = 2166136261U;
+    int i;
+    for (i = 0; i < math_key_ptr; i++) {
+        h = (h ^ (unsigned int) math_key[i]) * 16777619U;
+    }
+    return h;
+}
+
+static math_cache_entry *find_math_cache(unsigned int h)
+{
+    math_cache_entry *e = math_cache[h % math_cache_buckets];
+    while (e != NULL) {
+        if (e->hash == h && e->length == math_key_ptr && memcmp(e->key, math_key, (size_t) math_key_ptr * sizeof(int)) == 0)
+            return e;
+        e = e->next;
+    }
+    return NULL;
+}
+
+static void store_math_cache(unsigned int h, halfword hlist)
+{
+    math_cache_entry *e;
+    if (math_cache_entries >= math_cache_max)
+        flush_math_cache();
+    e = xmalloc(sizeof(math_cache_entry));
+    e->hash = h;
+    e->length = math_key_ptr;
+    e->key = xmalloc((unsigned) (math_key_ptr * sizeof(int)));
+    memcpy(e->key, math_key, (size_t) math_key_ptr * sizeof(int));
+    e->hlist = copy_node_list(hlist);
+    e->next = math_cache[h % math_cache_buckets];
+    math_cache[h % math_cache_buckets] = e;
+    math_cache_entries++;
+}
+
+static void cached_mlist_to_hlist(halfword p, boolean penalties, int mstyle)
+{
+    unsigned int h;
+    math_cache_entry *e;
+    if (! make_math_key(p, penalties, mstyle)) {
+        math_cache_skipped++;
+        mlist_to_hlist(p, penalties, mstyle);
+        return;
+    }
+    h = math_key_hash();
+    e = find_math_cache(h);
+    if (e != NULL) {
+        math_cache_hits++;
+        flush_node_list(p);
+        vlink(temp_head) = copy_node_list(e->hlist);
+    } else {
+        math_cache_misses++;
+        mlist_to_hlist(p, penalties, mstyle);
+        store_math_cache(h, vlink(temp_head));
+    }
+}
+
 void run_mlist_to_hlist(halfword p, boolean penalties, int mstyle)
 {
     int callback_id;
@@ -1865,7 +2129,10 @@ void run_mlist_to_hlist(halfword p, boolean penalties, int mstyle)
         vlink(temp_head) = a;
         lua_settop(Luas, sfix);
     } else if (callback_id == 0) {
-        mlist_to_hlist(p, penalties, mstyle);
+        if (math_cache_enabled)
+            cached_mlist_to_hlist(p, penalties, mstyle);
+        else
+            mlist_to_hlist(p, penalties, mstyle);
     } else {
         vlink(temp_head) = null;
     }
@@ -28,6 +28,15 @@ extern void run_mlist_to_hlist(halfword, boolean, int);
 extern void mlist_to_hlist(halfword, boolean, int);
 extern void fixup_math_parameters(int fam_id, int size_id, int f, int lvl);
 
+extern int math_cache_enabled;
+extern int math_cache_attribute;
+extern int math_cache_hits;
+extern int math_cache_misses;
+extern int math_cache_skipped;
+extern int math_cache_entries;
+
+extern void math_cache_enable(int enable, int attribute);
+
 extern scaled get_math_quad_style(int a);
 extern scaled get_math_quad_size(int a);
 
@@ -189,6 +189,10 @@ void scan_full_spec(group_code c, int spec_direction, int just_pack)
     cur_val = 0;
     done = true;
   FOUND:
+    if (attr_done) {
+        /*tex Boxes with the same |attr| specifications share their list. */
+        attr_list = intern_attribute_list(attr_list);
+    }
     add_node_attr_ref(attr_list);
     set_saved_record(0, saved_boxcontext, 0, s);
     set_saved_record(1, saved_boxspec, spec_code, cur_val);
@@ -1933,6 +1937,8 @@ halfword vsplit(halfword n, scaled h, int m)
         error();
         return null;
     }
+    /*tex The box is taken apart below, so we void it first. */
+    change_box(n, null);
     q = vert_break(list_ptr(v), h, split_max_depth_par);
     /*tex
 
@@ -1970,11 +1976,9 @@ halfword vsplit(halfword n, scaled h, int m)
     p = list_ptr(v);
     list_ptr(v) = null;
     flush_node(v);
-    if (q == null) {
+    if (q != null) {
         /*tex The |eq_level| of the box stays the same. */
-        box(n) = null;
-    } else {
-        box(n) = filtered_vpackage(q, 0, additional, max_depth_par, split_keep_group, vdir, 0, 0);
+        change_box(n, filtered_vpackage(q, 0, additional, max_depth_par, split_keep_group, vdir, 0, 0));
     }
     if (m == exactly) {
         return filtered_vpackage(p, h, exactly, split_max_depth_par, split_off_group, vdir, 0, 0);
@@ -2008,7 +2012,7 @@ void begin_box(int box_context)
             scan_register_num();
             cur_box = box(cur_val);
             /*tex The box becomes void, at the same level. */
-            box(cur_val) = null;
+            change_box(cur_val, null);
             break;
         case copy_code:
             scan_register_num();
@@ -2044,6 +2048,8 @@ void begin_box(int box_context)
                                 q = vlink(q);
                         }
                         uncouple_node(cur_list.tail_field);
+                        if (checkpointing)
+                            checkpoint_forget_node(cur_list.tail_field);
                         cur_box = cur_list.tail_field;
                         shift_amount(cur_box) = 0;
                         cur_list.tail_field = q;
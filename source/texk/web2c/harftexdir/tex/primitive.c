@@ -540,22 +540,26 @@ pointer id_lookup(int j, int l)
 /*tex
 
 Here is a similar subroutine for finding a primitive in the hash.
-This one is based on a C string.
+This one is based on a C string. When the hash code |h| of the string is
+already known, |hashed_string_lookup| can be used instead. Strings can
+contain zero bytes so they are compared with |memcmp|.
 
 */
 
 pointer string_lookup(const char *s, size_t l)
 {
-    /*tex The hash code: */
-    int h;
+    return hashed_string_lookup(s, l, compute_hash(s, (unsigned) l, hash_prime));
+}
+
+pointer hashed_string_lookup(const char *s, size_t l, halfword h)
+{
     /*tex The index in |hash| array: */
     pointer p;
-    h = compute_hash(s, (unsigned) l, hash_prime);
     /*tex We start searching here. Note that |0<=h<hash_prime|: */
     p = h + hash_base;
     while (1) {
         if (cs_text(p) > 0)
-            if (str_eq_cstr(cs_text(p), s, l))
+            if (str_length(cs_text(p)) == l && memcmp(str_string(cs_text(p)), s, l) == 0)
                 goto FOUND;
         if (cs_next(p) == 0) {
             if (no_new_control_sequence) {
@@ -84,6 +84,15 @@ extern void primitive_def(const char *s, size_t l, quarterword c, halfword o);
 extern void print_cmd_chr(quarterword cmd, halfword chr_code);
 
 extern pointer string_lookup(const char *s, size_t l);
+extern pointer hashed_string_lookup(const char *s, size_t l, halfword h);
 extern pointer id_lookup(int j, int l);
 
+/* the hash code of a string, starting at zero and extended one byte at a time */
+
+#  define hash_add_byte(h,b) do {      \
+    h = h + h + (unsigned char) (b);   \
+    while (h >= hash_prime)            \
+        h = h - hash_prime;            \
+} while (0)
+
 #endif                          /* LUATEX_PRIMITIVE_H */
@@ -21,10 +21,15 @@ with LuaTeX; if not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "ptexlib.h"
+#include "lua/luatex-api.h"
 
 #include <string.h>
 #include <kpathsea/absolute.h>
 
+#ifndef _WIN32
+#  include <sys/mman.h>
+#endif
+
 /*tex
 
 The bane of portability is the fact that different operating systems treat input
@@ -81,6 +86,70 @@ int namelength;
 int *input_file_callback_id;
 int read_file_callback_id[17];
 
+/*tex
+
+    Instead of a |reader| function the table returned by |open_read_file| can
+    have a |buffer| string with the whole file. The lines are then split off
+    that string directly, so there is no callback per line. We keep our own
+    reference to the string, the callback id is the key.
+
+*/
+
+typedef struct lua_input_block {
+    int id;
+    int ref;
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+} lua_input_block;
+
+static lua_input_block *lua_input_blocks = NULL;
+static int lua_input_block_count = 0;
+static int lua_input_block_max = 0;
+
+static void open_lua_input_block(int id)
+{
+    int top = lua_gettop(Luas);
+    luaL_checkstack(Luas, 3, "out of stack space");
+    lua_rawgeti(Luas, LUA_REGISTRYINDEX, id);
+    if (lua_type(Luas, -1) == LUA_TTABLE) {
+        lua_getfield(Luas, -1, "reader");
+        lua_getfield(Luas, -2, "buffer");
+        if (lua_type(Luas, -2) != LUA_TFUNCTION && lua_type(Luas, -1) == LUA_TSTRING) {
+            lua_input_block *b;
+            if (lua_input_block_count == lua_input_block_max) {
+                lua_input_block_max += 16;
+                lua_input_blocks = xrealloc(lua_input_blocks, (unsigned) lua_input_block_max * sizeof(lua_input_block));
+            }
+            b = &lua_input_blocks[lua_input_block_count++];
+            b->id = id;
+            b->data = (const unsigned char *) lua_tolstring(Luas, -1, &b->size);
+            b->pos = 0;
+            b->ref = luaL_ref(Luas, LUA_REGISTRYINDEX);
+        }
+    }
+    lua_settop(Luas, top);
+}
+
+static lua_input_block *find_lua_input_block(int id)
+{
+    int i;
+    for (i = 0; i < lua_input_block_count; i++) {
+        if (lua_input_blocks[i].id == id)
+            return &lua_input_blocks[i];
+    }
+    return NULL;
+}
+
+static void close_lua_input_block(int id)
+{
+    lua_input_block *b = find_lua_input_block(id);
+    if (b != NULL) {
+        luaL_unref(Luas, LUA_REGISTRYINDEX, b->ref);
+        *b = lua_input_blocks[--lua_input_block_count];
+    }
+}
+
 /*tex
 
     Here we handle |-output-directory|. We assume that it is OK to look here
@@ -307,6 +376,7 @@ boolean lua_a_open_in(alpha_file * f, char *fn, int n)
         k = run_and_save_callback(callback_id, "S->", fnam);
         if (k > 0) {
             ret = true;
+            open_lua_input_block(k);
             if (n == 0)
                 input_file_callback_id[iindex] = k;
             else
@@ -398,6 +468,7 @@ void lua_a_close_in(alpha_file f, int n)
     else
         callback_id = read_file_callback_id[n];
     if (callback_id > 0) {
+        close_lua_input_block(callback_id);
         run_saved_callback(callback_id, "close", "->");
         destroy_saved_callback(callback_id);
         if (n == 0)
@@ -496,16 +567,21 @@ boolean lua_input_ln(alpha_file f, int n, boolean bypass_eoln)
     else
         callback_id = read_file_callback_id[n];
     if (callback_id > 0) {
-        last = first;
-        last_ptr = first;
-        lua_result =
-            run_saved_callback(callback_id, "reader", "->l", &last_ptr);
-        if ((lua_result == true) && (last_ptr != 0)) {
-            last = last_ptr;
-            if (last > max_buf_stack)
-                max_buf_stack = last;
+        lua_input_block *b = lua_input_block_count > 0 ? find_lua_input_block(callback_id) : NULL;
+        if (b != NULL) {
+            lua_result = input_block_line(b->data, b->size, &b->pos);
         } else {
-            lua_result = false;
+            last = first;
+            last_ptr = first;
+            lua_result =
+                run_saved_callback(callback_id, "reader", "->l", &last_ptr);
+            if ((lua_result == true) && (last_ptr != 0)) {
+                last = last_ptr;
+                if (last > max_buf_stack)
+                    max_buf_stack = last;
+            } else {
+                lua_result = false;
+            }
         }
     } else {
         lua_result = input_ln(f, bypass_eoln);
@@ -517,8 +593,7 @@ boolean lua_input_ln(alpha_file f, int n, boolean bypass_eoln)
             if (callback_id > 0) {
                 last_ptr = first;
                 lua_result =
-                    run_callback(callback_id, "l->l", (last - first),
-                                 &last_ptr);
+                    run_line_callback(callback_id, (last - first), &last_ptr);
                 if ((lua_result == true) && (last_ptr != 0)) {
                     last = last_ptr;
                     if (last > max_buf_stack)
@@ -601,6 +676,11 @@ boolean init_terminal(void)
             return true;
         }
     }
+    if (server_socket != NULL) {
+        /*tex A server gets its first lines from the jobs it forks. */
+        iloc = first;
+        return true;
+    }
     while (1) {
         wake_up_terminal();
         fputs("**", term_out);
@@ -1098,6 +1178,340 @@ void start_input(void)
 
 static gzFile gz_fmtfile = NULL;
 
+/*tex
+
+    Next to the compressed big endian format there is a native layout that is
+    made when |--native-format| is given. It is not compressed and it uses the
+    byte order and sizes of the machine that made it, so nothing has to be
+    inflated or swapped when it is loaded. Blocks of some size start at a page
+    boundary and are listed in a section table at the end of the file:
+
+    \starttyping
+    header | items | padding | section | items | ... | section table
+    \stoptyping
+
+    When loading, the file is mapped read|-|only and undumping becomes a plain
+    copy from the mapping. The engine grows and frees its arrays later on, so
+    they can't point into the mapping themselves. Such a format can only be
+    loaded on the same kind of machine, which is checked.
+
+*/
+
+int native_format = 0;
+
+#define FMT_NATIVE_MAGIC   "LTXFMTN1"
+#define FMT_NATIVE_ORDER   0x01020304
+#define FMT_NATIVE_PAGE    4096
+#define FMT_NATIVE_SECTION 16384
+
+typedef struct {
+    char magic[8];
+    unsigned int byte_order;
+    unsigned int word_size;
+    unsigned int pointer_size;
+    unsigned int section_count;
+    unsigned long long section_table;
+    unsigned long long size;
+} fmt_native_header;
+
+typedef struct {
+    unsigned long long offset;
+    unsigned long long length;
+} fmt_native_section;
+
+typedef enum {
+    fmt_gz_mode,
+    fmt_native_write_mode,
+    fmt_native_read_mode,
+} fmt_mode_type;
+
+static struct {
+    fmt_mode_type mode;
+    FILE *file;
+    unsigned char *data;
+    size_t size;
+    size_t pos;
+    size_t limit;
+    boolean mapped;
+    fmt_native_section *sections;
+    unsigned count;
+    unsigned allocated;
+    unsigned next;
+    const char *magic;
+    boolean lenient;
+    boolean failed;
+} fmt_native = { fmt_gz_mode, NULL, NULL, 0, 0, 0, false, NULL, 0, 0, 0, NULL, false, false };
+
+static void native_fmt_write(const void *p, size_t n)
+{
+    if (fwrite(p, 1, n, fmt_native.file) != n) {
+        fprintf(stderr, "! Could not write %lu bytes to the format file.\n", (unsigned long) n);
+        uexit(1);
+    }
+    fmt_native.pos += n;
+}
+
+static void native_fmt_pad(size_t alignment)
+{
+    static const char zeros[64] = { 0 };
+    while (fmt_native.pos % alignment != 0) {
+        size_t n = alignment - fmt_native.pos % alignment;
+        native_fmt_write(zeros, n > 64 ? 64 : n);
+    }
+}
+
+static void native_fmt_dump(const char *p, size_t n)
+{
+    if (n >= FMT_NATIVE_SECTION) {
+        native_fmt_pad(FMT_NATIVE_PAGE);
+        if (fmt_native.count == fmt_native.allocated) {
+            fmt_native.allocated = fmt_native.allocated == 0 ? 64 : 2 * fmt_native.allocated;
+            fmt_native.sections = xrealloc(fmt_native.sections, fmt_native.allocated * sizeof(fmt_native_section));
+        }
+        fmt_native.sections[fmt_native.count].offset = fmt_native.pos;
+        fmt_native.sections[fmt_native.count].length = n;
+        fmt_native.count++;
+    }
+    native_fmt_write(p, n);
+}
+
+/*tex
+
+    A damaged format ends the run, but a damaged font cache must not. When the
+    reading is |lenient| an error only marks it as failed and from then on zeros
+    are returned, so that the caller can finish and throw the result away.
+
+*/
+
+static void native_fmt_undump_error(char *p, size_t n, const char *msg)
+{
+    if (!fmt_native.lenient) {
+        fprintf(stderr, "! Could not undump %lu bytes: %s.\n", (unsigned long) n, msg);
+        uexit(1);
+    }
+    fmt_native.failed = true;
+    memset(p, 0, n);
+}
+
+static void native_fmt_undump(char *p, size_t n)
+{
+    if (fmt_native.failed) {
+        memset(p, 0, n);
+        return;
+    }
+    if (n >= FMT_NATIVE_SECTION) {
+        if (fmt_native.next >= fmt_native.count || fmt_native.sections[fmt_native.next].length != n) {
+            native_fmt_undump_error(p, n, "no matching section");
+            return;
+        }
+        fmt_native.pos = (size_t) fmt_native.sections[fmt_native.next++].offset;
+    }
+    if (n > fmt_native.limit - fmt_native.pos) {
+        native_fmt_undump_error(p, n, "the format file is truncated");
+        return;
+    }
+    memcpy(p, fmt_native.data + fmt_native.pos, n);
+    fmt_native.pos += n;
+}
+
+static void open_native_fmt_output(FILE * f, const char *magic)
+{
+    fmt_native_header h;
+    memset(&h, 0, sizeof(fmt_native_header));
+    fmt_native.mode = fmt_native_write_mode;
+    fmt_native.magic = magic;
+    fmt_native.file = f;
+    fmt_native.pos = 0;
+    fmt_native.count = 0;
+    /*tex The real header is written when we're done. */
+    native_fmt_write(&h, sizeof(fmt_native_header));
+}
+
+static void close_native_fmt_output(void)
+{
+    fmt_native_header h;
+    memset(&h, 0, sizeof(fmt_native_header));
+    memcpy(h.magic, fmt_native.magic, 8);
+    h.byte_order = FMT_NATIVE_ORDER;
+    h.word_size = (unsigned) sizeof(memory_word);
+    h.pointer_size = (unsigned) sizeof(void *);
+    h.section_count = fmt_native.count;
+    native_fmt_pad(sizeof(fmt_native_section));
+    h.section_table = fmt_native.pos;
+    if (fmt_native.count > 0)
+        native_fmt_write(fmt_native.sections, fmt_native.count * sizeof(fmt_native_section));
+    h.size = fmt_native.pos;
+    if (fseek(fmt_native.file, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(fmt_native_header), 1, fmt_native.file) != 1) {
+        fprintf(stderr, "! Could not write the format file header.\n");
+        uexit(1);
+    }
+    fclose(fmt_native.file);
+    xfree(fmt_native.sections);
+    fmt_native.allocated = 0;
+    fmt_native.mode = fmt_gz_mode;
+}
+
+/*tex
+
+    This returns |false| when the file doesn't start with |magic|, in which case
+    it is rewound so that it can be read as compressed format. Other problems
+    quit the run when |fatal| is set and otherwise also make it return |false|.
+
+*/
+
+static void unmap_native_fmt_input(void)
+{
+#ifndef _WIN32
+    if (fmt_native.mapped)
+        munmap(fmt_native.data, fmt_native.size);
+    else
+#endif
+        xfree(fmt_native.data);
+    fmt_native.data = NULL;
+    fmt_native.sections = NULL;
+}
+
+static boolean native_fmt_error(const char *msg, boolean fatal)
+{
+    if (fatal) {
+        fprintf(stderr, "! %s.\n", msg);
+        uexit(1);
+    }
+    return false;
+}
+
+static boolean open_native_fmt_input(FILE * f, const char *magic, boolean fatal)
+{
+    fmt_native_header h;
+    long size;
+    unsigned i;
+    if (fread(&h, sizeof(fmt_native_header), 1, f) != 1 || memcmp(h.magic, magic, 8) != 0) {
+        fseek(f, 0, SEEK_SET);
+        return false;
+    }
+    if (h.byte_order != FMT_NATIVE_ORDER || h.word_size != sizeof(memory_word) || h.pointer_size != sizeof(void *)) {
+        return native_fmt_error("The format file was made on a different kind of machine", fatal);
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || (unsigned long long) size != h.size
+        || h.section_table > h.size || (h.size - h.section_table) / sizeof(fmt_native_section) < h.section_count) {
+        return native_fmt_error("The format file is damaged", fatal);
+    }
+    fmt_native.size = (size_t) size;
+    fmt_native.mapped = false;
+#ifndef _WIN32
+    fmt_native.data = mmap(NULL, fmt_native.size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (fmt_native.data == MAP_FAILED) {
+        fmt_native.data = NULL;
+    } else {
+        fmt_native.mapped = true;
+    }
+#endif
+    if (fmt_native.data == NULL) {
+        fmt_native.data = xmalloc(fmt_native.size);
+        if (fseek(f, 0, SEEK_SET) != 0 || fread(fmt_native.data, 1, fmt_native.size, f) != fmt_native.size) {
+            xfree(fmt_native.data);
+            return native_fmt_error("Could not read the format file", fatal);
+        }
+    }
+    fmt_native.sections = (fmt_native_section *) (fmt_native.data + h.section_table);
+    fmt_native.count = h.section_count;
+    for (i = 0; i < fmt_native.count; i++) {
+        if (fmt_native.sections[i].offset > h.section_table
+            || fmt_native.sections[i].length > h.section_table - fmt_native.sections[i].offset) {
+            unmap_native_fmt_input();
+            return native_fmt_error("The format file is damaged", fatal);
+        }
+    }
+    fmt_native.mode = fmt_native_read_mode;
+    fmt_native.file = f;
+    fmt_native.pos = sizeof(fmt_native_header);
+    fmt_native.limit = (size_t) h.section_table;
+    fmt_native.next = 0;
+    return true;
+}
+
+static void close_native_fmt_input(void)
+{
+    unmap_native_fmt_input();
+    fclose(fmt_native.file);
+    fmt_native.mode = fmt_gz_mode;
+    fmt_native.lenient = false;
+    fmt_native.failed = false;
+}
+
+/*tex
+
+    Font caches (see |texfont.c|) use the same layout with their own magic. As
+    these are optional a file that can't be used is simply not opened.
+
+*/
+
+boolean open_native_dump_file(const char *name, const char *magic)
+{
+    FILE *f;
+    if (fmt_native.mode != fmt_gz_mode || (f = fopen(name, FOPEN_WBIN_MODE)) == NULL)
+        return false;
+    open_native_fmt_output(f, magic);
+    return true;
+}
+
+void close_native_dump_file(void)
+{
+    close_native_fmt_output();
+}
+
+boolean open_native_undump_file(const char *name, const char *magic)
+{
+    FILE *f;
+    if (fmt_native.mode != fmt_gz_mode || (f = fopen(name, FOPEN_RBIN_MODE)) == NULL)
+        return false;
+    if (!open_native_fmt_input(f, magic, false)) {
+        fclose(f);
+        return false;
+    }
+    fmt_native.lenient = true;
+    fmt_native.failed = false;
+    return true;
+}
+
+/*tex This tells if all of the file was read without problems. */
+
+boolean close_native_undump_file(void)
+{
+    boolean ok = !fmt_native.failed && fmt_native.next == fmt_native.count
+        && fmt_native.limit - fmt_native.pos < sizeof(fmt_native_section);
+    close_native_fmt_input();
+    return ok;
+}
+
+boolean native_undump_failed(void)
+{
+    return fmt_native.failed;
+}
+
+/*tex
+
+    Values read from a font cache are checked before they are used. A bad one
+    fails a lenient read and makes this return |false|. A format is trusted, as
+    it always was.
+
+*/
+
+boolean native_undump_sane(boolean ok)
+{
+    if (ok || !fmt_native.lenient)
+        return true;
+    fmt_native.failed = true;
+    return false;
+}
+
+/*tex An array can't hold more items than fit in the file. */
+
+boolean native_undump_size(int n, size_t item)
+{
+    return native_undump_sane(n >= 0 && (size_t) n <= fmt_native.size / item);
+}
+
 /*tex
 
     As distributed, the dump files are architecture dependent; specifically,
@@ -1220,6 +1634,10 @@ void do_zdump(char *p, int item_size, int nitems, FILE * out_file)
     (void) out_file;
     if (nitems == 0)
         return;
+    if (fmt_native.mode == fmt_native_write_mode) {
+        native_fmt_dump(p, (size_t) item_size * (size_t) nitems);
+        return;
+    }
 #if !defined (WORDS_BIGENDIAN) && !defined (NO_DUMP_SHARE)
     swap_items(p, nitems, item_size);
 #endif
@@ -1239,6 +1657,10 @@ void do_zundump(char *p, int item_size, int nitems, FILE * in_file)
     (void) in_file;
     if (nitems == 0)
         return;
+    if (fmt_native.mode == fmt_native_read_mode) {
+        native_fmt_undump(p, (size_t) item_size * (size_t) nitems);
+        return;
+    }
     if (gzread(gz_fmtfile, (void *) p, (unsigned) (item_size * nitems)) <= 0) {
         fprintf(stderr, "Could not undump %d %d-byte item(s): %s.\n", nitems, item_size, gzerror(gz_fmtfile, &err));
         uexit(1);
@@ -1276,7 +1698,7 @@ boolean zopen_w_input(FILE ** f, const char *fname, int format, const_string fop
     } else {
         res = luatex_open_input(f, fname, format, fopen_mode, true);
     }
-    if (res) {
+    if (res && !open_native_fmt_input(*f, FMT_NATIVE_MAGIC, true)) {
         gz_fmtfile = gzdopen(fileno(*f), "rb" COMPRESSION);
     }
     return res;
@@ -1294,7 +1716,10 @@ boolean zopen_w_output(FILE ** f, const char *s, const_string fopen_mode)
         res = luatex_open_output(f, s, fopen_mode);
     }
     if (res) {
-        gz_fmtfile = gzdopen(fileno(*f), "wb" COMPRESSION);
+        if (native_format)
+            open_native_fmt_output(*f, FMT_NATIVE_MAGIC);
+        else
+            gz_fmtfile = gzdopen(fileno(*f), "wb" COMPRESSION);
     }
     return res;
 }
@@ -1302,7 +1727,12 @@ boolean zopen_w_output(FILE ** f, const char *s, const_string fopen_mode)
 void zwclose(FILE * f)
 {
     (void) f;
-    gzclose(gz_fmtfile);
+    if (fmt_native.mode == fmt_native_write_mode)
+        close_native_fmt_output();
+    else if (fmt_native.mode == fmt_native_read_mode)
+        close_native_fmt_input();
+    else
+        gzclose(gz_fmtfile);
 }
 
 /*tex Create the \DVI\ or \PDF\ file. */
@@ -1491,6 +1921,7 @@ boolean open_out_or_pipe(FILE ** f_ptr, char *fn, const_string fopen_mode)
 void close_file_or_pipe(FILE * f)
 {
     int i;
+    release_input_block(f);
     if (shellenabledp) {
         for (i = 0; i <= 15; i++) {
             /*tex If this file was a pipe, |pclose()| it and return. */
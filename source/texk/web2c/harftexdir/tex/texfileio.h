@@ -119,11 +119,20 @@ extern void start_input(void);
 
 extern int open_outfile(FILE ** f, const char *name, const char *mode);
 
+extern int native_format;
 extern boolean zopen_w_input(FILE **, const char *, int,
                              const_string fopen_mode);
 extern boolean zopen_w_output(FILE **, const char *, const_string fopen_mode);
 extern void zwclose(FILE *);
 
+extern boolean open_native_dump_file(const char *name, const char *magic);
+extern void close_native_dump_file(void);
+extern boolean open_native_undump_file(const char *name, const char *magic);
+extern boolean close_native_undump_file(void);
+extern boolean native_undump_failed(void);
+extern boolean native_undump_sane(boolean ok);
+extern boolean native_undump_size(int n, size_t item);
+
 #  define read_tfm_file  readbinfile
 #  define read_vf_file   readbinfile
 #  define read_data_file readbinfile
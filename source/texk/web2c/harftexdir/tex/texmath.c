@@ -296,6 +296,19 @@ static void unsave_math_param_data(int gl)
     }
 }
 
+/*tex
+
+    The combined signature of the families and parameters changes with every
+    assignment and returns to its old value when a group ends. The cache for
+    formulas depends on it.
+
+*/
+
+uint64_t math_data_signature(void)
+{
+    return math_fam_head->signature ^ (math_param_head->signature * 31);
+}
+
 /*tex Saving and unsaving of both: */
 
 void unsave_math_data(int gl)
@@ -231,6 +231,7 @@ extern const char *math_param_names[];
 extern void def_math_param(int param_code, int style_code, scaled value,
                            int lvl);
 extern scaled get_math_param(int param_code, int style_code);
+extern uint64_t math_data_signature(void);
 
 
 typedef enum {
@@ -2442,8 +2442,10 @@ void flush_node(halfword p)
         case inserting_node:
         case split_up_node:
         case expr_node:
-        case attribute_node:
         case attribute_list_node:
+            unintern_attribute_list(p);
+            break;
+        case attribute_node:
         case temp_node:
             break;
         default:
@@ -2739,6 +2741,8 @@ void free_node(halfword p, int s)
 #ifdef CHECK_NODE_USAGE
     varmem_sizes[p] = 0;
 #endif
+    if (checkpointing)
+        checkpoint_forget_node(p);
     if (s < MAX_CHAIN_SIZE) {
         vlink(p) = free_chain[s];
         free_chain[s] = p;
@@ -3117,6 +3121,7 @@ halfword copy_attribute_list(halfword n)
     register halfword p = q;
     type(p) = attribute_list_node;
     attr_list_ref(p) = 0;
+    attr_list_slot(p) = -1;
     n = vlink(n);
     while (n != null) {
         register halfword r = get_node(attribute_node_size);
@@ -3129,10 +3134,187 @@ halfword copy_attribute_list(halfword n)
     return q;
 }
 
+/*tex
+
+    Attribute lists made from the current attribute values are hash-consed: when
+    an equal list already exists it is shared, so a document that switches
+    between a few attribute states (colors, languages, tags) ends up with a few
+    lists instead of one per switch. The table stores list heads; the slot of a
+    list is kept in the otherwise unused value field of its head, so removing it
+    is cheap. Equal interned lists are the same list which makes comparing them
+    a pointer test. An interned list is never changed in place: setting or
+    unsetting an attribute in a node that uses one makes a copy first.
+
+    An interned list is released like any other list: when the last node that
+    uses it lets go and its reference count drops to zero it is removed from
+    the table and freed. Only a list that became the current one but was never
+    used by a node stays in the table, so that the next switch back to the same
+    attributes finds it again.
+
+*/
+
+#define attr_table_deleted -1
+
+static halfword *attr_table = NULL;
+static int attr_table_size = 0;
+static int attr_table_used = 0;
+
+#define attr_hash_step(h,i,v) \
+    h = ((h ^ (unsigned int) (i)) * 16777619U ^ (unsigned int) (v)) * 16777619U
+
+static unsigned int attribute_list_hash(halfword a)
+{
+    unsigned int h = 2166136261U;
+    a = vlink(a);
+    while (a != null) {
+        attr_hash_step(h, attribute_id(a), attribute_value(a));
+        a = vlink(a);
+    }
+    return h;
+}
+
+static boolean equal_attribute_nodes(halfword a, halfword b)
+{
+    a = vlink(a);
+    b = vlink(b);
+    while (a != null && b != null) {
+        if (attribute_id(a) != attribute_id(b) || attribute_value(a) != attribute_value(b))
+            return false;
+        a = vlink(a);
+        b = vlink(b);
+    }
+    return a == b;
+}
+
+boolean attribute_list_interned(halfword a)
+{
+    if (attr_table != NULL && a != null && a != cache_disabled) {
+        int k = attr_list_slot(a);
+        return k >= 0 && k < attr_table_size && attr_table[k] == a;
+    }
+    return false;
+}
+
+void unintern_attribute_list(halfword a)
+{
+    if (attribute_list_interned(a)) {
+        attr_table[attr_list_slot(a)] = attr_table_deleted;
+    }
+}
+
+static void insert_attribute_list(halfword a, unsigned int h)
+{
+    int k = (int) (h & (unsigned int) (attr_table_size - 1));
+    while (attr_table[k] != null && attr_table[k] != attr_table_deleted) {
+        k = (k + 1) & (attr_table_size - 1);
+    }
+    if (attr_table[k] == null)
+        attr_table_used++;
+    attr_table[k] = a;
+    attr_list_slot(a) = k;
+}
+
+static void grow_attribute_table(void)
+{
+    halfword *old = attr_table;
+    int n = attr_table_size;
+    int k;
+    int live = 0;
+    /*tex Freed lists leave holes, so the table doesn't always have to grow. */
+    for (k = 0; k < n; k++) {
+        if (old[k] != null && old[k] != attr_table_deleted)
+            live++;
+    }
+    attr_table_size = 1024;
+    while (attr_table_size < 4 * live)
+        attr_table_size = 2 * attr_table_size;
+    attr_table = xcalloc((unsigned) attr_table_size, sizeof(halfword));
+    attr_table_used = 0;
+    for (k = 0; k < n; k++) {
+        if (old[k] != null && old[k] != attr_table_deleted)
+            insert_attribute_list(old[k], attribute_list_hash(old[k]));
+    }
+    xfree(old);
+}
+
+/*tex
+
+    Interning a fresh list, one that no node uses yet, either returns an equal
+    list that is already known, in which case the fresh one is freed, or
+    registers and returns the list itself. The table doesn't hold a reference:
+    |delete_attribute_ref| takes the list out again when it frees it.
+
+*/
+
+halfword intern_attribute_list(halfword a)
+{
+    unsigned int h;
+    int k;
+    if (a == null)
+        return null;
+    if (2 * (attr_table_used + 1) > attr_table_size)
+        grow_attribute_table();
+    h = attribute_list_hash(a);
+    k = (int) (h & (unsigned int) (attr_table_size - 1));
+    while (attr_table[k] != null) {
+        halfword b = attr_table[k];
+        if (b != attr_table_deleted && b != a && equal_attribute_nodes(a, b)) {
+            free_node_chain(a, attribute_node_size);
+            return b;
+        }
+        k = (k + 1) & (attr_table_size - 1);
+    }
+    insert_attribute_list(a, h);
+    return a;
+}
+
+/*tex
+
+    The current attributes are first looked up in the table so that a hit
+    doesn't need any node memory.
+
+*/
+
+static halfword find_current_attribute_list(void)
+{
+    unsigned int h = 2166136261U;
+    int i, k;
+    if (attr_table == NULL)
+        return null;
+    for (i = 0; i <= max_used_attr; i++) {
+        register int v = attribute(i);
+        if (v > UNUSED_ATTRIBUTE) {
+            attr_hash_step(h, i, v);
+        }
+    }
+    k = (int) (h & (unsigned int) (attr_table_size - 1));
+    while (attr_table[k] != null) {
+        halfword b = attr_table[k];
+        if (b != attr_table_deleted) {
+            halfword p = vlink(b);
+            for (i = 0; i <= max_used_attr; i++) {
+                register int v = attribute(i);
+                if (v > UNUSED_ATTRIBUTE) {
+                    if (p == null || attribute_id(p) != i || attribute_value(p) != v)
+                        break;
+                    p = vlink(p);
+                }
+            }
+            if (i > max_used_attr && p == null)
+                return b;
+        }
+        k = (k + 1) & (attr_table_size - 1);
+    }
+    return null;
+}
+
 void update_attribute_cache(void)
 {
     halfword p;
     register int i;
+    attr_list_cache = find_current_attribute_list();
+    if (attr_list_cache != null)
+        return;
     attr_list_cache = get_node(attribute_node_size);
     type(attr_list_cache) = attribute_list_node;
     attr_list_ref(attr_list_cache) = 0;
@@ -3148,6 +3330,8 @@ void update_attribute_cache(void)
     if (vlink(attr_list_cache) == null) {
         free_node(attr_list_cache, attribute_node_size);
         attr_list_cache = null;
+    } else {
+        attr_list_cache = intern_attribute_list(attr_list_cache);
     }
     return;
 }
@@ -3206,6 +3390,7 @@ void delete_attribute_ref(halfword b)
             if (attr_list_ref(b) == 0) {
                 if (b == attr_list_cache)
                     attr_list_cache = cache_disabled;
+                unintern_attribute_list(b);
                 free_node_chain(b, attribute_node_size);
             }
             /*tex Maintain sanity. */
@@ -3307,7 +3492,7 @@ void set_attribute(halfword n, int i, int val)
             formatted_warning("nodes","node %d has an attribute list that is free already, case 1",(int) n);
             /*tex The still dangling list gets ref count 1. */
             attr_list_ref(p) = 1;
-        } else if (attr_list_ref(p) == 1) {
+        } else if (attr_list_ref(p) == 1 && ! attribute_list_interned(p)) {
             /*tex This can really happen! */
             if (p == attr_list_cache) {
                 /*tex
@@ -3322,7 +3507,7 @@ void set_attribute(halfword n, int i, int val)
                 attr_list_ref(p) = 1;
             }
         } else {
-            /*tex The list is used multiple times so we make a copy. */
+            /*tex The list is used multiple times or shared via the table so we make a copy. */
             p = copy_attribute_list(p);
             /*tex We decrement the ref count or the original. */
             delete_attribute_ref(node_attr(n));
@@ -3377,9 +3562,9 @@ int unset_attribute(halfword n, int i, int val)
             return UNUSED_ATTRIBUTE;
         /*tex If we are still here, the attribute exists. */
         p = node_attr(n);
-        if (attr_list_ref(p) > 1 || p == attr_list_cache) {
+        if (attr_list_ref(p) > 1 || p == attr_list_cache || attribute_list_interned(p)) {
             halfword q = copy_attribute_list(p);
-            if (attr_list_ref(p) > 1) {
+            if (attr_list_ref(p) > 1 || p != attr_list_cache) {
                 delete_attribute_ref(node_attr(n));
             }
             attr_list_ref(q) = 1;
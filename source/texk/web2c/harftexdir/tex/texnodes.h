@@ -72,6 +72,7 @@ extern void undump_node_mem(void);
 #  define cache_disabled max_halfword
 
 #  define attr_list_ref(a)   vinfo((a)+1) /* the reference count */
+#  define attr_list_slot(a)  vlink((a)+1) /* the slot in the table of shared lists */
 #  define attribute_id(a)    vinfo((a)+1)
 #  define attribute_value(a) vlink((a)+1)
 
@@ -91,6 +92,9 @@ extern void undump_node_mem(void);
 extern void update_attribute_cache(void);
 extern halfword copy_attribute_list(halfword n);
 extern halfword do_set_attribute(halfword p, int i, int val);
+extern halfword intern_attribute_list(halfword a);
+extern boolean attribute_list_interned(halfword a);
+extern void unintern_attribute_list(halfword a);
 
 #  define width_offset 2
 #  define depth_offset 3
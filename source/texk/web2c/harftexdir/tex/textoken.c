@@ -150,11 +150,24 @@ void initialize_tokens(void)
     Single-word node allocation:
 */
 
+static boolean grow_fixmem(unsigned t)
+{
+    /*tex The big dynamic storage area. */
+    smemory_word *new_fixmem;
+    new_fixmem = fixmemcast(realloc(fixmem, sizeof(smemory_word) * (fix_mem_max + t + 1)));
+    if (new_fixmem == NULL) {
+        return false;
+    }
+    fixmem = new_fixmem;
+    memset(voidcast(fixmem + fix_mem_max + 1), 0, t * sizeof(smemory_word));
+    fix_mem_max += t;
+    return true;
+}
+
 halfword get_avail(void)
 {
     /*tex The new node being got: */
     unsigned p;
-    unsigned t;
     /*tex Get top location in the |avail| stack. */
     p = (unsigned) avail;
     if (p != null) {
@@ -165,19 +178,11 @@ halfword get_avail(void)
         incr(fix_mem_end);
         p = fix_mem_end;
     } else {
-        /*tex The big dynamic storage area. */
-        smemory_word *new_fixmem;
-        t = (fix_mem_max / 5);
-        new_fixmem = fixmemcast(realloc(fixmem, sizeof(smemory_word) * (fix_mem_max + t + 1)));
-        if (new_fixmem == NULL) {
+        if (!grow_fixmem(fix_mem_max / 5)) {
             /*tex If memory is exhausted, display possible runaway text. */
             runaway();
             overflow("token memory size", fix_mem_max);
-        } else {
-            fixmem = new_fixmem;
         }
-        memset(voidcast(fixmem + fix_mem_max + 1), 0, t * sizeof(smemory_word));
-        fix_mem_max += t;
         p = ++fix_mem_end;
     }
     /*tex Provide an oft-desired initialization of the new node. */
@@ -212,6 +217,48 @@ void flush_list(halfword p)
     }
 }
 
+/*tex
+
+    A list that is built while scanning takes its nodes from the |avail| stack,
+    so a macro body can end up scattered all over |fixmem|. Because bodies are
+    read over and over again, |pack_token_list| copies a list into consecutive
+    nodes taken from virgin territory, which makes expansion walk through memory
+    in order. The copy is still an ordinary linked list, so nothing else has to
+    know about it.
+
+    The original nodes go back to the |avail| stack. To keep memory from growing
+    without bounds, nothing is packed when that would leave more than half of the
+    token memory unused; the list is returned as it is then.
+
+*/
+
+halfword pack_token_list(halfword p)
+{
+    halfword q, r;
+    unsigned n = 0;
+    unsigned k, total;
+    boolean packed = true;
+    for (q = p; q != null; q = token_link(q)) {
+        if (token_link(q) != null && token_link(q) != q + 1)
+            packed = false;
+        n++;
+    }
+    total = fix_mem_end - fix_mem_min + 1 + n;
+    if (packed || (int) total - dyn_used > (int) (total / 2))
+        return p;
+    if (fix_mem_end + n > fix_mem_max && !grow_fixmem(n + fix_mem_max / 5))
+        return p;
+    k = fix_mem_end + 1;
+    fix_mem_end += n;
+    dyn_used += (int) n;
+    for (q = p, r = (halfword) k; q != null; q = token_link(q), r++) {
+        token_info(r) = token_info(q);
+        token_link(r) = token_link(q) == null ? null : r + 1;
+    }
+    flush_list(p);
+    return (halfword) k;
+}
+
 /*tex
 
     A \TeX\ token is either a character or a control sequence, and it is
@@ -2054,6 +2101,8 @@ void get_next(void)
             goto RESTART;
         }
     }
+    if (macro_profiling)
+        macro_profile_token();
     /*tex If an alignment entry has just ended, take appropriate action. */
     if ((cur_cmd == tab_mark_cmd || cur_cmd == car_ret_cmd) && align_state == 0) {
         insert_vj_template();
@@ -2620,6 +2669,7 @@ static int do_variable_pdf(halfword c)
     else if (scan_keyword("omitcidset"))           { do_variable_backend_int(c_pdf_omit_cidset); }
     else if (scan_keyword("omitcharset"))          { do_variable_backend_int(c_pdf_omit_charset); }
     else if (scan_keyword("recompress"))           { do_variable_backend_int(c_pdf_recompress); }
+    else if (scan_keyword("fontworkers"))          { do_variable_backend_int(c_pdf_font_workers); }
 
     else if (scan_keyword("horigin"))              { do_variable_backend_dimen(d_pdf_h_origin); }
     else if (scan_keyword("vorigin"))              { do_variable_backend_dimen(d_pdf_v_origin); }
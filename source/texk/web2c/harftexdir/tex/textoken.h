@@ -77,6 +77,7 @@ extern halfword avail;          /* head of the list of available one-word nodes
 extern unsigned fix_mem_end;    /* the last one-word node used in |mem| */
 
 extern halfword get_avail(void);
+extern halfword pack_token_list(halfword p);
 
 /* A one-word node is recycled by calling |free_avail|.
 This routine is part of \TeX's ``inner loop,'' so we want it to be fast.
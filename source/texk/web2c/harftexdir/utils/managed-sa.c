@@ -31,12 +31,55 @@ LuaTeX; if not, see <http://www.gnu.org/licenses/>.
 
 #include "ptexlib.h"
 
+/*tex
+
+    The pages with the actual values are shared between copies of a tree, for
+    instance catcode tables made with \.{\savecatcodetable} or hjcodes that
+    start out as the lccodes. Each page is preceded by two hidden items: a
+    reference count and the number it got when it was dumped. A page that is
+    shared gets copied before it is changed.
+
+*/
+
+#define sa_page_refs(p)    ((p)[-2].int_value)
+#define sa_page_dump_id(p) ((p)[-1].int_value)
+
+static sa_tree_item *new_sa_page(void)
+{
+    sa_tree_item *p = (sa_tree_item *) Mxmalloc_array(sa_tree_item, LOWPART + 2) + 2;
+    sa_page_refs(p) = 1;
+    sa_page_dump_id(p) = 0;
+    return p;
+}
+
+static void release_sa_page(sa_tree_item *p)
+{
+    if (p != NULL && --sa_page_refs(p) == 0) {
+        free(p - 2);
+    }
+}
+
+static sa_tree_item *own_sa_page(sa_tree head, int h, int m)
+{
+    sa_tree_item *p = head->tree[h][m];
+    if (sa_page_refs(p) > 1) {
+        sa_tree_item *q = new_sa_page();
+        memcpy(q, p, sizeof(sa_tree_item) * LOWPART);
+        sa_page_refs(p)--;
+        head->tree[h][m] = q;
+        return q;
+    }
+    return p;
+}
+
 static void store_sa_stack(sa_tree a, int n, sa_tree_item v, int gl)
 {
     sa_stack_item st;
     st.code = n;
     st.value = v;
     st.level = gl;
+    if (a->journaled && checkpointing)
+        checkpoint_sa_push(a);
     if (a->stack == NULL) {
         a->stack = Mxmalloc_array(sa_stack_item, a->stack_size);
     } else if (((a->stack_ptr) + 1) >= a->stack_size) {
@@ -54,6 +97,8 @@ static void skip_in_stack(sa_tree a, int n)
         return;
     while (p > 0) {
         if (a->stack[p].code == n && a->stack[p].level > 0) {
+            if (a->journaled && checkpointing)
+                checkpoint_sa_skip(a, p);
             a->stack[p].level = -(a->stack[p].level);
         }
         p--;
@@ -74,6 +119,26 @@ sa_tree_item get_sa_item(const sa_tree head, const int n)
     return head->dflt;
 }
 
+/*tex
+
+    The signature of a tree is the exclusive or of a hash of all its cells, so
+    it can be kept up to date per assignment and it returns to its old value
+    when a group restores the old values. Two trees (or one tree at two moments)
+    with the same signature are therefore, for all practical purposes, equal.
+    Only copies inherit the signature: for a new or undumped tree it starts at
+    zero, which is fine as long as signatures of the same tree are compared.
+
+*/
+
+static uint64_t sa_item_signature(int n, sa_tree_item v)
+{
+    uint64_t x = ((uint64_t) v.dump_uint.value_1 << 32) | v.dump_uint.value_2;
+    x ^= (uint64_t) (unsigned int) n * 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
 void set_sa_item(sa_tree head, int n, sa_tree_item v, int gl)
 {
     int h = HIGHPART_PART(n);
@@ -87,22 +152,30 @@ void set_sa_item(sa_tree head, int n, sa_tree_item v, int gl)
     }
     if (head->tree[h][m] == NULL) {
         int i;
-        head->tree[h][m] = (sa_tree_item *) Mxmalloc_array(sa_tree_item, LOWPART);
+        head->tree[h][m] = new_sa_page();
         for (i = 0; i < LOWPART; i++) {
             head->tree[h][m][i] = head->dflt;
         }
+    } else {
+        own_sa_page(head, h, m);
     }
     if (gl <= 1) {
         skip_in_stack(head, n);
     } else {
         store_sa_stack(head, n, head->tree[h][m][l], gl);
     }
+    if (head->journaled && checkpointing)
+        checkpoint_sa_value(head, n, head->tree[h][m][l]);
+    head->signature ^= sa_item_signature(n, head->tree[h][m][l]) ^ sa_item_signature(n, v);
     head->tree[h][m][l] = v;
 }
 
 void rawset_sa_item(sa_tree head, int n, sa_tree_item v)
 {
-    head->tree[HIGHPART_PART(n)][MIDPART_PART(n)][LOWPART_PART(n)] = v;
+    if (head->journaled && checkpointing)
+        checkpoint_sa_value(head, n, get_sa_item(head, n));
+    head->signature ^= sa_item_signature(n, get_sa_item(head, n)) ^ sa_item_signature(n, v);
+    own_sa_page(head, HIGHPART_PART(n), MIDPART_PART(n))[LOWPART_PART(n)] = v;
 }
 
 void clear_sa_stack(sa_tree a)
@@ -116,12 +189,14 @@ void destroy_sa_tree(sa_tree a)
 {
     if (a == NULL)
         return;
+    if (a->journaled && checkpointing)
+        checkpoint_sa_forget(a);
     if (a->tree != NULL) {
         int h, m;
         for (h = 0; h < HIGHPART; h++) {
             if (a->tree[h] != NULL) {
                 for (m = 0; m < MIDPART; m++) {
-                    xfree(a->tree[h][m]);
+                    release_sa_page(a->tree[h][m]);
                 }
                 xfree(a->tree[h]);
             }
@@ -132,6 +207,8 @@ void destroy_sa_tree(sa_tree a)
     xfree(a);
 }
 
+/*tex A copy only duplicates the upper levels of the tree, the pages are shared. */
+
 sa_tree copy_sa_tree(sa_tree b)
 {
     sa_tree a = (sa_tree) Mxmalloc_array(sa_tree_head, 1);
@@ -139,6 +216,8 @@ sa_tree copy_sa_tree(sa_tree b)
     a->stack_size = b->stack_size;
     a->stack_type = b->stack_type;
     a->dflt = b->dflt;
+    a->journaled = b->journaled;
+    a->signature = b->signature;
     a->stack = NULL;
     a->stack_ptr = 0;
     a->tree = NULL;
@@ -150,9 +229,8 @@ sa_tree copy_sa_tree(sa_tree b)
                 a->tree[h] = (sa_tree_item **) Mxcalloc_array(void *, MIDPART);
                 for (m = 0; m < MIDPART; m++) {
                     if (b->tree[h][m] != NULL) {
-                        a->tree[h][m] = Mxmalloc_array(sa_tree_item, LOWPART);
-                        memcpy(a->tree[h][m], b->tree[h][m],
-                               sizeof(sa_tree_item) * LOWPART);
+                        a->tree[h][m] = b->tree[h][m];
+                        sa_page_refs(a->tree[h][m])++;
                     }
                 }
             }
@@ -185,6 +263,8 @@ sa_tree new_sa_tree(int size, int type, sa_tree_item dflt)
     a->stack_step = size;
     a->stack_type = type;
     a->stack_ptr = 0;
+    a->journaled = 1;
+    a->signature = 0;
     return (sa_tree) a;
 }
 
@@ -202,6 +282,21 @@ void restore_sa_stack(sa_tree head, int gl)
     }
 }
 
+/*tex
+
+    In the format a page is flagged as absent (0), present (1), the first
+    occurrence of a shared page (2), or a reference to a shared page that has
+    been dumped before (3), in which case only its number follows. This way the
+    sharing survives a dump and undump.
+
+*/
+
+static int sa_dump_count = 0;
+
+static sa_tree_item **sa_undump_pages = NULL;
+static int sa_undump_size = 0;
+static int sa_undump_count = 0;
+
 void dump_sa_tree(sa_tree a, const char * name)
 {
     boolean f;
@@ -220,8 +315,18 @@ void dump_sa_tree(sa_tree a, const char * name)
                 f = 1;
                 dump_qqqq(f);
                 for (m = 0; m < MIDPART; m++) {
-                    if (a->tree[h][m] != NULL) {
-                        f = 1;
+                    if (a->tree[h][m] != NULL && sa_page_dump_id(a->tree[h][m]) > 0) {
+                        f = 3;
+                        dump_qqqq(f);
+                        x = sa_page_dump_id(a->tree[h][m]);
+                        dump_int(x);
+                    } else if (a->tree[h][m] != NULL) {
+                        if (sa_page_refs(a->tree[h][m]) > 1) {
+                            sa_page_dump_id(a->tree[h][m]) = ++sa_dump_count;
+                            f = 2;
+                        } else {
+                            f = 1;
+                        }
                         dump_qqqq(f);
                         for (l = 0; l < LOWPART; l++) {
                             if (n == 2) {
@@ -263,6 +368,8 @@ sa_tree undump_sa_tree(const char * name)
     a->dflt.int_value = x;
     a->stack = Mxmalloc_array(sa_stack_item, a->stack_size);
     a->stack_ptr = 0;
+    a->journaled = 1;
+    a->signature = 0;
     a->tree = NULL;
     /*tex The marker: */
     undump_int(x);
@@ -277,8 +384,22 @@ sa_tree undump_sa_tree(const char * name)
             a->tree[h] = (sa_tree_item **) Mxcalloc_array(void *, MIDPART);
             for (m = 0; m < MIDPART; m++) {
                 undump_qqqq(f);
-                if (f > 0) {
-                    a->tree[h][m] = Mxmalloc_array(sa_tree_item, LOWPART);
+                if (f == 3) {
+                    undump_int(x);
+                    if (x < 1 || x > sa_undump_count) {
+                        formatted_error("fmt", "bad shared page in %s", name);
+                    }
+                    a->tree[h][m] = sa_undump_pages[x - 1];
+                    sa_page_refs(a->tree[h][m])++;
+                } else if (f > 0) {
+                    a->tree[h][m] = new_sa_page();
+                    if (f == 2) {
+                        if (sa_undump_count == sa_undump_size) {
+                            sa_undump_size = sa_undump_size + 64;
+                            sa_undump_pages = xrealloc(sa_undump_pages, (unsigned) (sa_undump_size * sizeof(sa_tree_item *)));
+                        }
+                        sa_undump_pages[sa_undump_count++] = a->tree[h][m];
+                    }
                     for (l = 0; l < LOWPART; l++) {
                         if (n == 2) {
                             undump_int(x);
@@ -77,6 +77,8 @@ typedef struct {
     sa_tree_item ***tree;       /* item tree head       */
     sa_stack_item *stack;       /* stack tree head      */
     sa_tree_item dflt;          /* default item value   */
+    int journaled;              /* checkpoints see it   */
+    uint64_t signature;         /* hash of the contents */
 } sa_tree_head;
 
 typedef sa_tree_head *sa_tree;
@@ -122,6 +122,37 @@ if (fd->subset_tag != NULL) {
         formatted_warning("subsets","subset-tag collision, resolved in round %d",j);
 }
 
+/*tex
+
+    The caches that keep converted resources across runs identify a file by its
+    checksum. The size and modification time are returned too so that an entry
+    can also be checked against them. This returns zero when the file can't be
+    read.
+
+*/
+
+int get_file_checksum(const char *path, unsigned char *digest, long long *size, long long *mtime)
+{
+    struct stat st;
+    FILE *f;
+    md5_state_t state;
+    unsigned char buf[16384];
+    size_t n;
+    if (stat(path, &st) != 0)
+        return 0;
+    f = fopen(path, FOPEN_RBIN_MODE);
+    if (f == NULL)
+        return 0;
+    md5_init(&state);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        md5_append(&state, (const md5_byte_t *) buf, (int) n);
+    fclose(f);
+    md5_finish(&state, (md5_byte_t *) digest);
+    *size = (long long) st.st_size;
+    *mtime = (long long) st.st_mtime;
+    return 1;
+}
+
 __attribute__ ((format(printf, 1, 2)))
 void tex_printf(const char *fmt, ...)
 {
@@ -26,6 +26,7 @@ extern int epochseconds;
 extern int microseconds;
 
 void make_subset_tag(fd_entry *);
+int get_file_checksum(const char *path, unsigned char *digest, long long *size, long long *mtime);
 
 __attribute__ ((format(printf, 1, 2)))
 void tex_printf(const char *, ...);